@@ -0,0 +1,283 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+#include <future>
+#include <numeric>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include "args.hxx"
+#include "stats.hpp"
+#include "common.hpp"
+
+constexpr size_t io_alignment = 4096;
+
+struct GeneratorConfig {
+    size_t n;
+    size_t chunk_size;
+    size_t threads;
+    size_t ma_order;
+    double ar1_phi;
+    double scale;
+    uint64_t seed;
+
+    GeneratorConfig(size_t n,
+                    size_t chunk_size,
+                    size_t threads,
+                    size_t ma_order,
+                    double ar1_phi,
+                    double scale,
+                    uint64_t seed)
+        : n(n),
+          chunk_size(chunk_size),
+          threads(threads),
+          ma_order(ma_order ? ma_order : 1),
+          ar1_phi(ar1_phi),
+          scale(scale),
+          seed(seed) {}
+};
+
+/**
+ * Generates the keys of a chunk relative to the key preceding the chunk, that is, the prefix sums of its gaps. The
+ * gaps follow the same processes used by simulate, each chunk starting the process afresh from its own random stream.
+ * @return the sum of the gaps of the chunk
+ */
+template<typename Dist>
+uint64_t generate_chunk(const GeneratorConfig &cfg, Dist distribution, size_t chunk, uint64_t *out, size_t length) {
+    std::seed_seq seq{uint32_t(cfg.seed), uint32_t(cfg.seed >> 32), uint32_t(chunk), uint32_t(chunk >> 32)};
+    std::mt19937 gen(seq);
+    GapProcess<Dist> gaps(gen, distribution, cfg.ma_order, cfg.ar1_phi);
+    double x = 0;
+
+    for (size_t i = 0; i < length; ++i) {
+        auto gap = gaps.next(gen);
+        if (gap < 0) {
+            std::cerr << "The process generated a negative gap, so the keys would not be sorted" << std::endl;
+            exit(1);
+        }
+        x += gap;
+
+        // Beyond 2^53 the key would be inexact, and beyond 2^64 converting it to an integer would be undefined
+        auto key = std::floor(x * cfg.scale);
+        if (!(key < 0x1p53)) {
+            std::cerr << "The keys of a chunk exceed 2^53, try a smaller --scale or --chunk" << std::endl;
+            exit(1);
+        }
+        out[i] = uint64_t(key);
+    }
+
+    return length ? out[length - 1] : 0;
+}
+
+void write_all(int fd, const char *data, size_t size, off_t offset) {
+    while (size > 0) {
+        auto written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+/**
+ * Writes n sorted keys to a file in the binary format read by real_gaps -b (the number of keys followed by the keys,
+ * all as 64-bit unsigned integers). The chunks of a batch are generated in parallel and then shifted by the prefix sums
+ * of the previous chunks, while the previous batch is written with large aligned writes.
+ */
+template<typename Dist>
+void write_keys(const GeneratorConfig &cfg, Dist &distribution, const std::string &filename) {
+    auto fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL)
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << filename << ": " << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+
+    auto n_chunks = (cfg.n + cfg.chunk_size - 1) / cfg.chunk_size;
+    auto batch_chunks = cfg.threads;
+    auto buffer_size = batch_chunks * cfg.chunk_size * sizeof(uint64_t) + io_alignment;
+    std::unique_ptr<char, decltype(&std::free)> buffers[2] = {
+        {(char *) std::aligned_alloc(io_alignment, buffer_size), &std::free},
+        {(char *) std::aligned_alloc(io_alignment, buffer_size), &std::free}
+    };
+    if (!buffers[0] || !buffers[1]) {
+        std::cerr << "Cannot allocate the output buffers" << std::endl;
+        exit(1);
+    }
+
+    // The bytes that did not fill an aligned block are carried to the front of the next buffer
+    uint64_t size = cfg.n;
+    std::memcpy(buffers[0].get(), &size, sizeof(size));
+    size_t carry = sizeof(size);
+    size_t current = 0;
+    off_t file_offset = 0;
+    uint64_t offset = 0;
+    std::vector<uint64_t> chunk_sums(batch_chunks);
+    std::future<void> pending_write;
+
+    for (size_t first_chunk = 0; first_chunk < n_chunks; first_chunk += batch_chunks) {
+        auto buffer = buffers[current].get();
+        auto keys = (uint64_t *) (buffer + carry);
+        auto last_chunk = std::min(n_chunks, first_chunk + batch_chunks);
+        auto batch_keys = std::min(cfg.n, last_chunk * cfg.chunk_size) - first_chunk * cfg.chunk_size;
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(cfg.threads)
+        for (auto c = first_chunk; c < last_chunk; ++c) {
+            auto begin = (c - first_chunk) * cfg.chunk_size;
+            auto length = std::min(cfg.chunk_size, batch_keys - begin);
+            chunk_sums[c - first_chunk] = generate_chunk(cfg, distribution, c, keys + begin, length);
+        }
+
+        std::vector<uint64_t> chunk_offsets(last_chunk - first_chunk);
+        for (size_t i = 0; i < chunk_offsets.size(); ++i) {
+            chunk_offsets[i] = offset;
+            if (offset + chunk_sums[i] < offset) {
+                std::cerr << "The keys overflow 64 bits, try a smaller --scale" << std::endl;
+                exit(1);
+            }
+            offset += chunk_sums[i];
+        }
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(cfg.threads)
+        for (auto c = first_chunk; c < last_chunk; ++c) {
+            auto begin = (c - first_chunk) * cfg.chunk_size;
+            auto length = std::min(cfg.chunk_size, batch_keys - begin);
+            auto chunk_offset = chunk_offsets[c - first_chunk];
+            for (size_t i = begin; i < begin + length; ++i)
+                keys[i] += chunk_offset;
+        }
+
+        auto bytes = carry + batch_keys * sizeof(uint64_t);
+        auto aligned_bytes = bytes / io_alignment * io_alignment;
+        if (pending_write.valid())
+            pending_write.get();
+        carry = bytes - aligned_bytes;
+        current ^= 1u;
+        std::memcpy(buffers[current].get(), buffer + aligned_bytes, carry);
+        pending_write = std::async(std::launch::async, write_all, fd, buffer, aligned_bytes, file_offset);
+        file_offset += aligned_bytes;
+
+        std::cerr << "\33[2K\r" << 100. * last_chunk / n_chunks << "%" << std::flush;
+    }
+
+    if (pending_write.valid())
+        pending_write.get();
+
+    // The last block is padded to the alignment, and the padding is then truncated
+    auto last = buffers[current].get();
+    std::memset(last + carry, 0, io_alignment - carry);
+    write_all(fd, last, carry ? io_alignment : 0, file_offset);
+    if (ftruncate(fd, file_offset + carry) != 0 || close(fd) != 0) {
+        std::cerr << filename << ": " << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+    std::cerr << std::endl;
+
+    std::cout << "# keys " << cfg.n << std::endl
+              << "# last key " << offset << std::endl;
+}
+
+template<typename Dist>
+void generate(const GeneratorConfig &cfg, Dist &distribution, const std::string &filename) {
+    auto[mean, variance] = get_moments(distribution);
+    std::cout.precision(17);
+    std::cout << "# mean " << mean << std::endl
+              << "# variance " << variance << std::endl;
+    if (cfg.ar1_phi != 0)
+        std::cout << "# autoregressive process phi " << cfg.ar1_phi << std::endl;
+    else
+        std::cout << "# moving-average process order " << cfg.ma_order << std::endl;
+    std::cout << "# scale " << cfg.scale << std::endl;
+
+    write_keys(cfg, distribution, filename);
+}
+
+int main(int argc, char **argv) {
+    args::ArgumentParser ap("Generate a file of sorted keys whose gaps follow a given distribution.", "");
+    args::HelpFlag help(ap, "help", "Display this help menu", {'h', "help"});
+
+    args::Group distributions(ap, "command");
+    args::Command uniform(distributions, "uniform", "Continuous uniform (min, max)");
+    args::Command pareto(distributions, "pareto", "Pareto (scale k, shape α)");
+    args::Command lognormal(distributions, "lognormal", "Lognormal (µ, σ)");
+    args::Command exponential(distributions, "exponential", "Exponential (rate λ)");
+    args::Command gamma(distributions, "gamma", "Gamma (shape k, scale θ)");
+
+    args::Group p(ap, "", args::Group::Validators::DontCare, args::Options::Required | args::Options::Global);
+    args::PositionalList<double> parameters(p, "parameters", "The distribution parameters");
+
+    args::Group o(ap, "general options", args::Group::Validators::DontCare, args::Options::Global);
+    args::ValueFlag<std::string> output(o, "file", "Output file", {'f'}, args::Options::Required);
+    args::ValueFlag<size_t> n(o, "n", "Number of keys", {'n'}, args::Options::Required);
+    args::ValueFlag<double> scale(o, "scale", "Multiply the gaps by this value before rounding the keys to integers",
+                                  {'S', "scale"}, 1);
+    args::ValueFlag<size_t> chunk(o, "chunk", "Number of keys generated by a thread at once", {"chunk"},
+                                  size_t(1) << 20);
+    args::ValueFlag<size_t> threads(o, "threads", "Number of threads", {'t'}, 4);
+    args::ValueFlag<uint64_t> seed(o, "seed", "Seed of the random streams", {"seed"}, 42);
+
+    args::Group c(ap, "options to simulate correlation", args::Group::Validators::AtMostOne, args::Options::Global);
+    args::ValueFlag<size_t> ma(c, "order", "Simulate a moving-average process MA(o) with the given order o", {'o'}, 0);
+    args::ValueFlag<double> ar1(c, "phi", "Simulate an autoregressive process AR(1) with the given φ param", {'a'}, 0);
+
+    try {
+        ap.ParseCLI(argc, argv);
+    }
+    catch (args::Help) {
+        std::cout << ap;
+        return 0;
+    }
+    catch (args::Error e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << ap;
+        return 1;
+    }
+
+    GeneratorConfig cfg(n.Get(), std::max<size_t>(chunk.Get(), 1), std::max<size_t>(threads.Get(), 1), ma.Get(),
+                        ar1.Get(), scale.Get(), seed.Get());
+
+    auto params = parameters.Get();
+    if (uniform) {
+        std::uniform_real_distribution<double> d(params.at(0), params.at(1));
+        generate(cfg, d, output.Get());
+    } else if (pareto) {
+        pareto_distribution<double> d(params.at(0), params.at(1));
+        generate(cfg, d, output.Get());
+    } else if (lognormal) {
+        std::lognormal_distribution<double> d(params.at(0), params.at(1));
+        generate(cfg, d, output.Get());
+    } else if (exponential) {
+        std::exponential_distribution<double> d(params.at(0));
+        generate(cfg, d, output.Get());
+    } else if (gamma) {
+        std::gamma_distribution<double> d(params.at(0), params.at(1));
+        generate(cfg, d, output.Get());
+    }
+}
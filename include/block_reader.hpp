@@ -0,0 +1,155 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+#include <condition_variable>
+
+/**
+ * Reads a binary file of values of type T in blocks, using a background thread that fills one buffer while the
+ * caller consumes the other. The resident memory is two blocks, regardless of the size of the file.
+ */
+template<typename T>
+class BlockReader {
+    std::fstream in;
+    size_t size_ = 0;
+    std::vector<T> buffers[2];
+    size_t lengths[2] = {0, 0};
+    bool ready[2] = {false, false};
+    size_t current = 2;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+
+    void fill_loop() {
+        size_t remaining = size_;
+        for (size_t i = 0;; i ^= 1u) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return !ready[i] || stop; });
+                if (stop)
+                    return;
+            }
+
+            auto length = std::min(remaining, buffers[i].size());
+            try {
+                in.read((char *) buffers[i].data(), length * sizeof(T));
+            }
+            catch (std::ios_base::failure &e) {
+                std::cerr << e.what() << std::endl;
+                std::cerr << std::strerror(errno) << std::endl;
+                exit(1);
+            }
+            remaining -= length;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                lengths[i] = length;
+                ready[i] = true;
+            }
+            cv.notify_all();
+            if (length == 0)
+                return;
+        }
+    }
+
+public:
+
+    /**
+     * Opens the given file and starts reading it in background.
+     * @param filename the path of the file
+     * @param block_size the number of values in each block
+     * @param first_is_size true if the file starts with the number of values as a 64-bit unsigned integer
+     */
+    explicit BlockReader(const std::string &filename, size_t block_size = 1u << 20, bool first_is_size = true) {
+        try {
+            auto openmode = std::ios::in | std::ios::binary;
+            if (!first_is_size)
+                openmode |= std::ios::ate;
+
+            in.open(filename, openmode);
+            in.exceptions(std::ios::failbit | std::ios::badbit);
+
+            if (first_is_size) {
+                uint64_t size = 0;
+                in.read((char *) &size, sizeof(size));
+                size_ = size;
+            }
+            else {
+                size_ = static_cast<size_t>(in.tellg() / sizeof(T));
+                in.seekg(0);
+            }
+        }
+        catch (std::ios_base::failure &e) {
+            std::cerr << e.what() << std::endl;
+            std::cerr << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+
+        buffers[0].resize(block_size);
+        buffers[1].resize(block_size);
+        thread = std::thread(&BlockReader::fill_loop, this);
+    }
+
+    BlockReader(const BlockReader &) = delete;
+
+    BlockReader &operator=(const BlockReader &) = delete;
+
+    ~BlockReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    /** Returns the number of values in the file. */
+    size_t size() const {
+        return size_;
+    }
+
+    /**
+     * Gives back the block returned by the previous call, and waits for the next one.
+     * @param length set to the number of values in the returned block, which is 0 at the end of the file
+     * @return a pointer to the values of the next block, valid until the next call
+     */
+    const T *next(size_t &length) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (current < 2) {
+            if (lengths[current] == 0) {
+                length = 0;
+                return nullptr;
+            }
+            ready[current] = false;
+            cv.notify_all();
+            current ^= 1u;
+        } else
+            current = 0;
+
+        cv.wait(lock, [&] { return ready[current]; });
+        length = lengths[current];
+        return buffers[current].data();
+    }
+};
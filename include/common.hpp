@@ -18,83 +18,235 @@
 #pragma once
 
 #include <random>
-#include <csignal>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <numeric>
 #include <iostream>
+#include <algorithm>
+#include "stats.hpp"
+#include "segmenters.hpp"
 #include "piecewise_linear_model.hpp"
 
 constexpr auto infinite_exit_time = 1000000000ul;
 
+/**
+ * The process generating the gaps between consecutive keys. If phi is zero, it is the moving-average process MA(o) in
+ * which each gap is the sum of the last o values drawn from the distribution. Otherwise, it is the autoregressive
+ * process AR(1) in which each gap is phi times the previous gap plus a noise drawn from the distribution.
+ */
 template<typename Dist>
+class GapProcess {
+    Dist distribution;
+    double phi;
+    std::vector<double> memory;
+    double memory_sum = 0;
+    double gap = 0;
+    uint64_t y = 0;
+
+public:
+
+    template<typename Gen>
+    GapProcess(Gen &gen, Dist distribution, size_t ma_order, double phi)
+        : distribution(distribution),
+          phi(phi),
+          memory(phi == 0 ? std::max<size_t>(ma_order, 1) : 0) {
+        std::generate(memory.begin(), memory.end(), [&] { return this->distribution(gen); });
+        memory_sum = std::accumulate(memory.begin(), memory.end(), 0.);
+    }
+
+    /** Returns the next gap. */
+    template<typename Gen>
+    double next(Gen &gen) {
+        if (phi != 0) {
+            gap = phi * gap + distribution(gen);
+            return gap;
+        }
+
+        ++y;
+        auto value = distribution(gen);
+        memory_sum -= memory[y % memory.size()];
+        gap = value + memory_sum;
+        memory[y % memory.size()] = value;
+        memory_sum += value;
+        return gap;
+    }
+};
+
+/**
+ * Feeds the points of a stream to MET and, unless met_only is true, to OPT until one of them exits. The points are
+ * drawn by next_point(y), which returns the x of the point with rank y, only when OPT asks for them through its bulk
+ * interface, so that no draw is wasted.
+ */
+template<typename NextPoint>
 std::tuple<uint64_t, uint64_t, double, double>
-simulate(Dist &gap_distribution, double epsilon, double slope, size_t ma_order, bool met_only) {
-    std::random_device rd;
-    thread_local std::mt19937 gen(rd());
-    double x = 0;
+simulate_stream(NextPoint next_point, double epsilon, double slope, bool met_only) {
     uint64_t strip_exit_time = infinite_exit_time;
+    MetSegmenter<double, double> met(epsilon, slope);
+    met.add_point(0, 0);
 
-    std::vector<double> memory(ma_order);
-    std::generate(memory.begin(), memory.end(), std::bind(gap_distribution, gen));
-    auto memory_sum = std::accumulate(memory.begin(), memory.end(), 0.);
+    if (met_only) {
+        for (uint64_t y = 1; y < infinite_exit_time; ++y)
+            if (!met.add_point(next_point(y), y))
+                return {0, y, 0, 0};
+        return {0, strip_exit_time, 0, 0};
+    }
 
     OptimalPiecewiseLinearModel<double, double> opt(epsilon, epsilon);
     opt.add_point(0, 0);
 
-    for (uint64_t y = 1; y < infinite_exit_time; ++y) {
-        auto gap = gap_distribution(gen);
-        memory_sum -= memory[y % ma_order];
-        x += gap + memory_sum;
-        memory[y % ma_order] = gap;
-        memory_sum += gap;
-
-        if (strip_exit_time == infinite_exit_time && std::fabs(y - slope * x) > epsilon) {
+    double previous_x = 0;
+    auto point_at = [&](size_t i) {
+        uint64_t y = i + 1;
+        auto x = next_point(y);
+        if (x < previous_x)
+            throw std::logic_error("Points must be increasing by x.");
+        previous_x = x;
+        if (strip_exit_time == infinite_exit_time && !met.add_point(x, y))
             strip_exit_time = y;
-            if (met_only)
-                return {0, strip_exit_time, 0, 0};
-        }
-        if (!met_only && !opt.add_point(x, y)) {
-            auto[lo, hi] = opt.get_slope_range();
-            return {y, strip_exit_time, lo, hi};
-        }
-    }
+        return std::pair<double, double>(x, y);
+    };
+    auto added = opt.add_points(infinite_exit_time - 1, point_at, [](size_t, double, double) { return false; });
 
+    if (added < infinite_exit_time - 1) {
+        auto[lo, hi] = opt.get_slope_range();
+        return {added + 1, strip_exit_time, lo, hi};
+    }
     return {infinite_exit_time, strip_exit_time, 0, 1};
 }
 
-template<typename Dist>
+template<typename Gen, typename Dist>
 std::tuple<uint64_t, uint64_t, double, double>
-simulate_ar1(Dist &noise_distribution, double epsilon, double slope, double phi, bool met_only) {
-    std::random_device rd;
-    thread_local std::mt19937 gen(rd());
+simulate(Gen &gen, Dist gap_distribution, double epsilon, double slope, size_t ma_order, bool met_only) {
+    GapProcess<Dist> gaps(gen, gap_distribution, ma_order, 0);
     double x = 0;
-    double gap = 0;
-    uint64_t strip_exit_time = infinite_exit_time;
+    return simulate_stream([&](uint64_t) { return x += gaps.next(gen); }, epsilon, slope, met_only);
+}
 
-    OptimalPiecewiseLinearModel<double, double> opt(epsilon, epsilon);
-    opt.add_point(0, 0);
+template<typename Gen, typename Dist>
+std::tuple<uint64_t, uint64_t, double, double>
+simulate_ar1(Gen &gen, Dist noise_distribution, double epsilon, double slope, double phi, bool met_only) {
+    GapProcess<Dist> gaps(gen, noise_distribution, 1, phi);
+    double x = 0;
+    return simulate_stream([&](uint64_t) { return x += gaps.next(gen); }, epsilon, slope, met_only);
+}
 
-    for (uint64_t y = 1; y < infinite_exit_time; ++y) {
-        gap = phi * gap + noise_distribution(gen);
-        x += gap;
-        if (strip_exit_time == infinite_exit_time && std::fabs(y - slope * x) > epsilon) {
-            strip_exit_time = y;
-            if (met_only)
-                return {0, strip_exit_time, 0, 0};
+/**
+ * The statistics on the exit times of the simulated streams for each value of ε. They can be written either as the
+ * final csv, or as a partial state that can be read back and merged with the partial states of other processes.
+ */
+struct ExitTimeStats {
+    size_t min_epsilon;
+    size_t max_epsilon;
+    size_t step;
+    std::vector<RunningStat> opt_exit_times;
+    std::vector<RunningStat> opt_lo;
+    std::vector<RunningStat> opt_hi;
+    std::vector<RunningStat> mean_exit_times;
+
+    ExitTimeStats(size_t min_epsilon, size_t max_epsilon, size_t step)
+        : min_epsilon(min_epsilon),
+          max_epsilon(max_epsilon),
+          step(step),
+          opt_exit_times(max_epsilon - min_epsilon + 1),
+          opt_lo(max_epsilon - min_epsilon + 1),
+          opt_hi(max_epsilon - min_epsilon + 1),
+          mean_exit_times(max_epsilon - min_epsilon + 1) {}
+
+    void push(size_t epsilon, uint64_t opt_exit_time, uint64_t exit_time, double lo, double hi) {
+        size_t j = epsilon - min_epsilon;
+        opt_exit_times[j].push(opt_exit_time);
+        mean_exit_times[j].push(exit_time);
+        opt_lo[j].push(lo);
+        opt_hi[j].push(hi);
+    }
+
+    void merge(const ExitTimeStats &other) {
+        if (other.min_epsilon != min_epsilon || other.max_epsilon != max_epsilon || other.step != step)
+            throw std::invalid_argument("The statistics refer to different ε values");
+        for (size_t j = 0; j < opt_exit_times.size(); ++j) {
+            opt_exit_times[j].merge(other.opt_exit_times[j]);
+            opt_lo[j].merge(other.opt_lo[j]);
+            opt_hi[j].merge(other.opt_hi[j]);
+            mean_exit_times[j].merge(other.mean_exit_times[j]);
         }
-        if (!met_only && !opt.add_point(x, y)) {
-            auto[lo, hi] = opt.get_slope_range();
-            return {y, strip_exit_time, lo, hi};
+    }
+
+    void write_csv(std::ostream &s) const {
+        s.precision(17);
+        s << "epsilon,"
+             "opt_avg,opt_std,"
+             "opt_lo_avg,opt_lo_std,"
+             "opt_hi_avg,opt_hi_std,"
+             "met_avg,met_std,"
+             "samples" << std::endl;
+        for (size_t i = 0; i < opt_exit_times.size(); i += step)
+            s << i + min_epsilon
+              << "," << opt_exit_times[i].mean() << "," << opt_exit_times[i].standard_deviation()
+              << "," << opt_lo[i].mean() << "," << opt_lo[i].standard_deviation()
+              << "," << opt_hi[i].mean() << "," << opt_hi[i].standard_deviation()
+              << "," << mean_exit_times[i].mean() << "," << mean_exit_times[i].standard_deviation()
+              << "," << mean_exit_times[i].samples() << std::endl;
+    }
+
+    void write_partial(std::ostream &s) const {
+        auto write_stat = [&](const RunningStat &r) {
+            s << "," << r.samples() << "," << r.mean() << "," << r.m2() << "," << r.total();
+        };
+
+        s.precision(17);
+        s << "# partial " << min_epsilon << " " << max_epsilon << " " << step << std::endl;
+        s << "epsilon,"
+             "opt_n,opt_mean,opt_m2,opt_total,"
+             "opt_lo_n,opt_lo_mean,opt_lo_m2,opt_lo_total,"
+             "opt_hi_n,opt_hi_mean,opt_hi_m2,opt_hi_total,"
+             "met_n,met_mean,met_m2,met_total" << std::endl;
+        for (size_t i = 0; i < opt_exit_times.size(); i += step) {
+            s << i + min_epsilon;
+            write_stat(opt_exit_times[i]);
+            write_stat(opt_lo[i]);
+            write_stat(opt_hi[i]);
+            write_stat(mean_exit_times[i]);
+            s << std::endl;
         }
     }
 
-    return {infinite_exit_time, strip_exit_time, 0, 1};
-}
+    /**
+     * Reads the partial state written by write_partial. The lines starting with '#' other than the "# partial" one
+     * are appended to comments.
+     */
+    static ExitTimeStats read_partial(std::istream &in, std::vector<std::string> &comments) {
+        std::string line;
+        while (std::getline(in, line) && line.rfind("# partial ", 0) != 0)
+            comments.push_back(line);
+
+        size_t min_epsilon, max_epsilon, step;
+        std::stringstream header(line.substr(10));
+        if (!(header >> min_epsilon >> max_epsilon >> step) || max_epsilon < min_epsilon || step == 0)
+            throw std::runtime_error("Missing or malformed \"# partial\" line");
 
-std::stringstream backup_output;
+        ExitTimeStats stats(min_epsilon, max_epsilon, step);
+        std::getline(in, line);
+        while (std::getline(in, line)) {
+            if (line.empty())
+                continue;
+            std::replace(line.begin(), line.end(), ',', ' ');
+            std::stringstream row(line);
+            size_t epsilon;
+            row >> epsilon;
+            if (epsilon < min_epsilon || epsilon > max_epsilon)
+                throw std::runtime_error("Unexpected ε value in line: " + line);
+
+            size_t j = epsilon - min_epsilon;
+            for (auto *v : {&stats.opt_exit_times, &stats.opt_lo, &stats.opt_hi, &stats.mean_exit_times}) {
+                size_t n;
+                double mean, m2, total;
+                if (!(row >> n >> mean >> m2 >> total))
+                    throw std::runtime_error("Malformed line: " + line);
+                (*v)[j] = RunningStat(n, mean, m2, total);
+            }
+        }
 
-void signal_handler(int s) {
-    std::cerr << backup_output.str() << std::endl;
-    if (s == SIGINT) {
-        std::cout << backup_output.str() << std::endl;
-        exit(1);
+        return stats;
     }
-}
\ No newline at end of file
+};
@@ -0,0 +1,107 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
+
+template<typename TypeOut>
+std::vector<TypeOut> read_dataset_csv(const std::string &filename) {
+    std::vector<TypeOut> dataset;
+
+    try {
+        std::fstream in(filename);
+        in.exceptions(std::ios::failbit | std::ios::badbit);
+        std::string line;
+
+        while (in.peek() != EOF && std::getline(in, line)) {
+            TypeOut value;
+            std::stringstream stringstream(line);
+            stringstream >> value;
+            dataset.push_back(value);
+        }
+    }
+    catch (std::ios_base::failure &e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+
+    return dataset;
+}
+
+/**
+ * Reads a binary file of values of type TypeIn. If first_is_size is true, the file starts with the number of values as
+ * a 64-bit unsigned integer, as in the SOSD format, regardless of the type of the values.
+ */
+template<typename TypeIn, typename TypeOut>
+std::vector<TypeOut> read_data_binary(const std::string &filename, bool first_is_size = true) {
+    try {
+        auto openmode = std::ios::in | std::ios::binary;
+        if (!first_is_size)
+            openmode |= std::ios::ate;
+
+        std::fstream in(filename, openmode);
+        in.exceptions(std::ios::failbit | std::ios::badbit);
+
+        uint64_t size = 0;
+        if (first_is_size)
+            in.read((char *) &size, sizeof(size));
+        else {
+            size = static_cast<size_t>(in.tellg() / sizeof(TypeIn));
+            in.seekg(0);
+        }
+
+        std::vector<TypeIn> data(size);
+        in.read((char *) data.data(), size * sizeof(TypeIn));
+        if constexpr (std::is_same<TypeIn, TypeOut>::value)
+            return data;
+
+        return std::vector<TypeOut>(data.begin(), data.end());
+    }
+    catch (std::ios_base::failure &e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+}
+
+template<typename V>
+void sort_and_deduplicate(V &dataset) {
+    std::sort(dataset.begin(), dataset.end());
+    dataset.erase(std::unique(dataset.begin(), dataset.end()), dataset.end());
+}
+
+template<typename V>
+typename V::value_type sort_and_replace_with_gaps(V &dataset) {
+    sort_and_deduplicate(dataset);
+    if (dataset.empty())
+        return {};
+    auto first = dataset.front();
+    for (size_t i = 0; i < dataset.size() - 1; ++i)
+        dataset[i] = dataset[i + 1] - dataset[i];
+    dataset.pop_back();
+    return first;
+}
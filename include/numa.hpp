@@ -0,0 +1,97 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <sched.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/** Returns the index of the calling thread in the current OpenMP team. */
+inline size_t thread_index() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+/** Returns the number of threads in the current OpenMP team. */
+inline size_t team_size() {
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+
+/**
+ * Returns the CPUs of each NUMA node, as listed in /sys/devices/system/node. If the list is not available, returns a
+ * single node with no CPUs, which means that threads are not pinned.
+ */
+inline std::vector<std::vector<int>> numa_nodes() {
+    std::vector<std::vector<int>> nodes;
+
+    for (size_t node = 0;; ++node) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string cpulist;
+        if (!in || !std::getline(in, cpulist))
+            break;
+
+        // The format is a comma-separated list of CPUs or ranges of CPUs, e.g. "0-13,28-41"
+        std::vector<int> cpus;
+        std::stringstream ranges(cpulist);
+        for (std::string range; std::getline(ranges, range, ',');) {
+            int first, last;
+            auto dash = range.find('-');
+            first = std::stoi(range.substr(0, dash));
+            last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (auto cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+
+    if (nodes.empty())
+        nodes.emplace_back();
+    return nodes;
+}
+
+/** Returns the node of a thread when the threads of a team are divided into contiguous groups, one per node. */
+inline size_t numa_node_of_thread(size_t thread, size_t threads, size_t n_nodes) {
+    return thread * n_nodes / threads;
+}
+
+/** Restricts the calling thread to run on the given CPUs. Returns false if the affinity could not be set. */
+inline bool pin_current_thread(const std::vector<int> &cpus) {
+    if (cpus.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+        CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
@@ -19,6 +19,8 @@
 #include <cmath>
 #include <limits>
 #include <vector>
+#include <algorithm>
+#include <utility>
 #include <stdexcept>
 #include <type_traits>
 
@@ -65,18 +67,22 @@ private:
     size_t lower_start = 0;
     size_t upper_start = 0;
     size_t points_in_hull = 0;
+    size_t max_hull_size = 0;
+    SX first_x = 0;
     Point rectangle[4];
 
+    static constexpr size_t prefetch_distance = 16;
+
     template<typename P>
     SX cross(const P &O, const P &A, const P &B) {
         return (A.x - O.x) * (B.y - O.y) - (A.y - O.y) * (B.x - O.x);
     }
 
 public:
-    explicit OptimalPiecewiseLinearModel(SY error_fwd, SY error_bwd)
+    explicit OptimalPiecewiseLinearModel(SY error_fwd, SY error_bwd, size_t hull_capacity = 1u << 16)
         : error_fwd(error_fwd), error_bwd(error_bwd) {
-        upper.reserve(1u << 16);
-        lower.reserve(1u << 16);
+        upper.reserve(hull_capacity);
+        lower.reserve(hull_capacity);
     }
 
     bool add_point(X x, Y y) {
@@ -87,6 +93,7 @@ public:
         SY yy = y;
 
         if (points_in_hull == 0) {
+            first_x = xx;
             rectangle[0] = {xx, yy + error_fwd};
             rectangle[1] = {xx, yy - error_bwd};
             ++points_in_hull;
@@ -103,6 +110,7 @@ public:
             lower.push_back(rectangle[1]);
             lower.push_back(rectangle[2]);
             upper_start = lower_start = 0;
+            max_hull_size = std::max<size_t>(max_hull_size, 4);
             ++points_in_hull;
             return true;
         }
@@ -142,6 +150,7 @@ public:
             for (; end >= upper_start + 2 && cross(upper[end - 2], upper[end - 1], p1) <= 0; --end);
             upper.resize(end);
             upper.push_back(p1);
+            max_hull_size = std::max(max_hull_size, lower.size() + upper.size());
         }
 
         if (p2 - rectangle[0] > slope1) {
@@ -167,12 +176,87 @@ public:
             for (; end >= lower_start + 2 && cross(lower[end - 2], lower[end - 1], p2) >= 0; --end);
             lower.resize(end);
             lower.push_back(p2);
+            max_hull_size = std::max(max_hull_size, lower.size() + upper.size());
         }
 
         ++points_in_hull;
         return true;
     }
 
+    /**
+     * Adds n points in bulk, stopping at the points that do not fit in the current segment. The points strictly inside
+     * the current rectangle, which are the most, do not change the hull and cost only the two tests that detect them.
+     * @param n the number of points
+     * @param point_at a function returning the i-th point as a pair (x, y), called once for each i in increasing order.
+     * Unlike add_point, the order of the points by x is not checked, so point_at must check it if it is not guaranteed
+     * @param on_segment a function called as on_segment(i, slope, intercept) when the i-th point does not fit in the
+     * current segment, with the parameters of the segment closed by that point as returned by get_segment. If it
+     * returns true, the i-th point starts a new segment, otherwise the function stops
+     * @return the number of points added, that is, n or the index of the point at which on_segment returned false
+     */
+    template<typename PointAt, typename OnSegment>
+    size_t add_points(size_t n, PointAt &&point_at, OnSegment &&on_segment) {
+        size_t i = 0;
+        while (i < n) {
+            if (points_in_hull < 2) {
+                auto[x, y] = point_at(i++);
+                add_point(x, y);
+                continue;
+            }
+
+            auto slope1 = rectangle[2] - rectangle[0];
+            auto slope2 = rectangle[3] - rectangle[1];
+            for (; i < n; ++i) {
+                auto[x, y] = point_at(i);
+                SX xx = x;
+                SY yy = y;
+                Point p1(xx, yy + error_fwd);
+                Point p2(xx, yy - error_bwd);
+                if (p1 - rectangle[2] < slope1 || p2 - rectangle[3] > slope2) {
+                    auto[slope, intercept] = get_segment();
+                    points_in_hull = 0;
+                    if (!on_segment(i, slope, intercept))
+                        return i;
+                    add_point(x, y);
+                    ++i;
+                    break;
+                }
+
+                if (p1 - rectangle[1] < slope2 || p2 - rectangle[0] > slope1) {
+                    // The point moves the rectangle, so the hull is updated and the slopes are computed again
+                    add_point(x, y);
+                    ++i;
+                    break;
+                }
+
+                ++points_in_hull;
+            }
+        }
+        return n;
+    }
+
+    /**
+     * Adds in bulk the points (keys[i] - origin, first_y + i) for i = 0, ..., n-1, prefetching the keys, see
+     * add_points. The difference is computed in the key type if it is an integer. The keys must be sorted and distinct,
+     * which is checked only for the first one.
+     */
+    template<typename K, typename OnSegment>
+    size_t add_keys(const K *keys, K origin, Y first_y, size_t n, OnSegment &&on_segment) {
+        auto point_at = [&](size_t i) {
+            __builtin_prefetch(keys + i + prefetch_distance);
+            if constexpr (std::is_integral_v<K>)
+                return std::pair<X, Y>(X(keys[i] - origin), Y(first_y + i));
+            else
+                return std::pair<X, Y>(X(keys[i]) - X(origin), Y(first_y + i));
+        };
+        if (n > 0 && points_in_hull > 0) {
+            SX x = point_at(0).first;
+            if (x < rectangle[2].x || x < rectangle[3].x)
+                throw std::logic_error("Points must be increasing by x.");
+        }
+        return add_points(n, point_at, on_segment);
+    }
+
     std::pair<double, double> get_intersection() const {
         auto &p0 = rectangle[0];
         auto &p1 = rectangle[1];
@@ -206,7 +290,19 @@ public:
         return {min_slope, max_slope};
     }
 
+    /** Returns the slope and the intercept at the first x of the current or just closed segment. */
+    std::pair<double, double> get_segment() const {
+        auto[min_slope, max_slope] = get_slope_range();
+        return {0.5 * (min_slope + max_slope), get_intercept(first_x)};
+    }
+
+    /** Returns the peak memory used by the model since its construction, counting the points stored in the hulls. */
+    size_t memory_usage() const {
+        return sizeof(*this) + max_hull_size * sizeof(Point);
+    }
+
     void reset() {
         points_in_hull = 0;
+        rectangle[2].x = rectangle[3].x = std::numeric_limits<SX>::lowest();
     }
 };
\ No newline at end of file
@@ -0,0 +1,214 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <csignal>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+std::stringstream backup_output;
+
+void signal_handler(int s) {
+    std::cerr << backup_output.str() << std::endl;
+    if (s == SIGINT) {
+        std::cout << backup_output.str() << std::endl;
+        exit(1);
+    }
+}
+
+/**
+ * A thread that reports the progress of a parallel experiment without slowing down its loop. The workers only
+ * increment their own counter. Every second, the reporter sums the counters and prints the progress and the estimated
+ * time left. At every percent of progress, it stores a snapshot of the output in backup_output. If a socket path is
+ * given, it also serves the metrics over HTTP on a Unix socket, e.g. to
+ * curl --unix-socket <path> http://localhost/metrics
+ */
+class ProgressReporter {
+    struct alignas(64) Counter {
+        std::atomic<uint64_t> value{0};
+    };
+
+    uint64_t total;
+    std::vector<Counter> counters;
+    std::function<std::stringstream()> output;
+    std::function<void(std::ostream &)> metrics;
+    std::string socket_path;
+    int listen_fd = -1;
+    std::atomic<bool> stop{false};
+    std::chrono::steady_clock::time_point begin;
+    std::thread thread;
+
+    uint64_t progress() const {
+        uint64_t sum = 0;
+        for (auto &c : counters)
+            sum += c.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    void open_socket() {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            std::cerr << socket_path << ": the socket path is too long" << std::endl;
+            exit(1);
+        }
+        std::strcpy(address.sun_path, socket_path.c_str());
+
+        unlink(socket_path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr *) &address, sizeof(address)) != 0
+            || listen(listen_fd, 8) != 0) {
+            std::cerr << socket_path << ": " << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+    }
+
+    void write_metrics(std::ostream &s, uint64_t done) const {
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        auto rate = elapsed > 0 ? done / elapsed : 0.;
+        s << "progress_streams " << done << "\n"
+          << "progress_streams_total " << total << "\n"
+          << "progress_ratio " << double(done) / total << "\n"
+          << "elapsed_seconds " << elapsed << "\n"
+          << "streams_per_second " << rate << "\n"
+          << "eta_seconds " << (rate > 0 ? (total - done) / rate : 0.) << "\n";
+        if (metrics)
+            metrics(s);
+    }
+
+    void serve() {
+        auto client = accept(listen_fd, nullptr, nullptr);
+        if (client < 0)
+            return;
+
+        // Consume the request, if any, so that closing the connection does not reset it
+        char request[1024];
+        pollfd pfd{client, POLLIN, 0};
+        while (poll(&pfd, 1, 100) > 0) {
+            auto n = recv(client, request, sizeof(request), 0);
+            if (n <= 0 || std::string(request, n).find("\r\n\r\n") != std::string::npos)
+                break;
+        }
+
+        std::stringstream body;
+        body.precision(17);
+        write_metrics(body, progress());
+        auto response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                        + std::to_string(body.str().size()) + "\r\n\r\n" + body.str();
+        for (size_t sent = 0; sent < response.size();) {
+            auto n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        close(client);
+    }
+
+    void run() {
+        constexpr auto tick = std::chrono::milliseconds(100);
+        auto last_print = begin;
+        uint64_t last_backup_percent = 0;
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            pollfd pfd{listen_fd, POLLIN, 0};
+            if (poll(&pfd, listen_fd < 0 ? 0 : 1, tick.count()) > 0)
+                serve();
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_print < std::chrono::seconds(1))
+                continue;
+            last_print = now;
+
+            auto done = progress();
+            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - begin).count();
+            auto seconds_left = done ? total * elapsed / done - elapsed : 0;
+            std::stringstream stream;
+            stream.precision(3);
+            stream << "\33[2K\r" << 100. * done / total
+                   << "% (" << seconds_left / 60 << "m" << seconds_left % 60 << "s left)";
+            std::cerr << stream.str() << std::flush;
+
+            auto percent = 100 * done / total;
+            if (output && percent > last_backup_percent) {
+                last_backup_percent = percent;
+                backup_output = output();
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Starts the reporter.
+     * @param total the number of iterations of the experiment
+     * @param threads the number of threads that advance the progress
+     * @param output returns the output of the experiment so far, stored periodically as a backup
+     * @param metrics writes additional metrics, in the format "name value" one per line
+     * @param socket_path the Unix socket where to serve the metrics, or an empty string to not serve them
+     */
+    ProgressReporter(uint64_t total, size_t threads, std::function<std::stringstream()> output,
+                     std::function<void(std::ostream &)> metrics, const std::string &socket_path = "")
+        : total(std::max<uint64_t>(total, 1)),
+          counters(std::max<size_t>(threads, 1)),
+          output(std::move(output)),
+          metrics(std::move(metrics)),
+          socket_path(socket_path),
+          begin(std::chrono::steady_clock::now()) {
+        if (!socket_path.empty())
+            open_socket();
+        thread = std::thread(&ProgressReporter::run, this);
+    }
+
+    ProgressReporter(const ProgressReporter &) = delete;
+
+    ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+    ~ProgressReporter() {
+        finish();
+    }
+
+    /** Records the completion of an iteration by the given thread, which must be the only one using that index. */
+    void advance(size_t thread_index) {
+        auto &c = counters[thread_index].value;
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /** Stops the reporter and closes the socket. */
+    void finish() {
+        if (!thread.joinable())
+            return;
+        stop.store(true, std::memory_order_relaxed);
+        thread.join();
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(socket_path.c_str());
+        }
+        std::cerr << std::endl;
+    }
+};
@@ -0,0 +1,214 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * A segment file stores the piecewise linear ε-approximation of a sorted array of n keys, so that it can be mapped
+ * in memory and queried without any deserialisation. The layout, in native byte order, is:
+ *
+ *   - a 64-byte SegmentFileHeader;
+ *   - the first key of each segment, sorted (n_segments values of the key type);
+ *   - the slope of each segment (n_segments doubles);
+ *   - the intercept of each segment (n_segments doubles).
+ *
+ * Each array starts at a multiple of 64 bytes. The position of a key k in the array is approximated by
+ * slope * (k - first key) + intercept using the segment with the largest first key not greater than k, and the error
+ * of such approximation is at most ε for every key in the array.
+ */
+
+constexpr char segment_file_magic[8] = {'P', 'W', 'L', 'M', 'S', 'E', 'G', '\0'};
+constexpr uint32_t segment_file_version = 1;
+constexpr size_t segment_file_alignment = 64;
+
+enum class KeyType : uint32_t { uint32 = 1, uint64 = 2, float32 = 3, float64 = 4 };
+
+template<typename K>
+constexpr KeyType key_type_of() {
+    if constexpr (std::is_same_v<K, uint32_t>)
+        return KeyType::uint32;
+    else if constexpr (std::is_same_v<K, uint64_t>)
+        return KeyType::uint64;
+    else if constexpr (std::is_same_v<K, float>)
+        return KeyType::float32;
+    else {
+        static_assert(std::is_same_v<K, double>, "Unsupported key type");
+        return KeyType::float64;
+    }
+}
+
+struct SegmentFileHeader {
+    char magic[8];
+    uint32_t version;
+    KeyType key_type;
+    uint64_t epsilon;
+    uint64_t n_keys;
+    uint64_t n_segments;
+    uint64_t keys_offset;
+    uint64_t slopes_offset;
+    uint64_t intercepts_offset;
+};
+
+static_assert(sizeof(SegmentFileHeader) == segment_file_alignment, "The header must fill one aligned block");
+
+template<typename K>
+struct Segment {
+    K key;
+    double slope;
+    double intercept;
+};
+
+/**
+ * Writes the given segments to a segment file.
+ * @param filename the path of the file to write
+ * @param epsilon the maximum error of the segments
+ * @param n_keys the number of keys approximated by the segments
+ * @param segments the segments, sorted by key
+ */
+template<typename K>
+void write_segment_file(const std::string &filename, uint64_t epsilon, uint64_t n_keys,
+                        const std::vector<Segment<K>> &segments) {
+    auto align = [](uint64_t offset) {
+        return (offset + segment_file_alignment - 1) / segment_file_alignment * segment_file_alignment;
+    };
+
+    SegmentFileHeader header{};
+    std::memcpy(header.magic, segment_file_magic, sizeof(header.magic));
+    header.version = segment_file_version;
+    header.key_type = key_type_of<K>();
+    header.epsilon = epsilon;
+    header.n_keys = n_keys;
+    header.n_segments = segments.size();
+    header.keys_offset = sizeof(SegmentFileHeader);
+    header.slopes_offset = align(header.keys_offset + segments.size() * sizeof(K));
+    header.intercepts_offset = align(header.slopes_offset + segments.size() * sizeof(double));
+    auto file_size = align(header.intercepts_offset + segments.size() * sizeof(double));
+
+    std::vector<char> buffer(file_size);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    auto keys = (K *) (buffer.data() + header.keys_offset);
+    auto slopes = (double *) (buffer.data() + header.slopes_offset);
+    auto intercepts = (double *) (buffer.data() + header.intercepts_offset);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        keys[i] = segments[i].key;
+        slopes[i] = segments[i].slope;
+        intercepts[i] = segments[i].intercept;
+    }
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    out.exceptions(std::ios::failbit | std::ios::badbit);
+    out.write(buffer.data(), buffer.size());
+}
+
+/**
+ * A read-only view of a segment file mapped in memory.
+ */
+template<typename K>
+class SegmentFileView {
+    void *data = MAP_FAILED;
+    size_t length = 0;
+    const SegmentFileHeader *header = nullptr;
+    const K *keys = nullptr;
+    const double *slopes = nullptr;
+    const double *intercepts = nullptr;
+
+public:
+
+    struct ApproxPos {
+        size_t pos; ///< The approximate position of the key.
+        size_t lo;  ///< The lower bound of the range.
+        size_t hi;  ///< The upper bound of the range.
+    };
+
+    explicit SegmentFileView(const std::string &filename) {
+        auto fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + filename + ": " + std::strerror(errno));
+
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SegmentFileHeader)) {
+            length = st.st_size;
+            data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Cannot map " + filename);
+
+        header = (const SegmentFileHeader *) data;
+        if (std::memcmp(header->magic, segment_file_magic, sizeof(segment_file_magic)) != 0
+            || header->version != segment_file_version
+            || header->key_type != key_type_of<K>()
+            || header->intercepts_offset + header->n_segments * sizeof(double) > length) {
+            munmap(data, length);
+            throw std::runtime_error(filename + " is not a compatible segment file");
+        }
+
+        auto base = (const char *) data;
+        keys = (const K *) (base + header->keys_offset);
+        slopes = (const double *) (base + header->slopes_offset);
+        intercepts = (const double *) (base + header->intercepts_offset);
+    }
+
+    SegmentFileView(const SegmentFileView &) = delete;
+
+    SegmentFileView &operator=(const SegmentFileView &) = delete;
+
+    ~SegmentFileView() {
+        if (data != MAP_FAILED)
+            munmap(data, length);
+    }
+
+    uint64_t epsilon() const { return header->epsilon; }
+
+    uint64_t size() const { return header->n_keys; }
+
+    uint64_t segments_count() const { return header->n_segments; }
+
+    Segment<K> segment(size_t i) const { return {keys[i], slopes[i], intercepts[i]}; }
+
+    /**
+     * Returns the approximate position of the given key in the indexed array, and the range where to search it.
+     * @param key the value to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        auto n = header->n_keys;
+        auto eps = header->epsilon;
+        auto it = std::upper_bound(keys, keys + header->n_segments, key);
+        if (it == keys)
+            return {0, 0, std::min<size_t>(n, eps + 1)};
+
+        auto i = size_t(std::distance(keys, it)) - 1;
+        auto p = slopes[i] * double(key - keys[i]) + intercepts[i];
+        auto pos = std::min<size_t>(p > 0 ? size_t(p) : 0, n ? n - 1 : 0);
+        auto lo = pos > eps ? pos - eps : 0;
+        auto hi = std::min<size_t>(pos + eps + 2, n);
+        return {pos, lo, hi};
+    }
+};
@@ -0,0 +1,197 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include "piecewise_linear_model.hpp"
+
+/*
+ * Streaming algorithms that partition a sequence of points with increasing x into segments, each approximating the y
+ * of its points within ±ε. They share the interface of OptimalPiecewiseLinearModel:
+ *
+ *   - bool add_point(X x, Y y) returns false if the point does not fit the current segment, which is then closed, and
+ *     the next call starts a new segment (so the caller passes the rejected point again to make it the first one);
+ *   - std::pair<double, double> get_slope_range() returns the range of slopes of the current or just closed segment;
+ *   - void reset() forgets the current segment and the previous points;
+ *   - size_t memory_usage() returns the peak bytes used for the state of the algorithm.
+ */
+
+/**
+ * The MET algorithm: a segment has a fixed slope, usually the reciprocal of the mean gap, and it ends as soon as a
+ * point leaves the strip of half-width ε around the line through the first point of the segment.
+ */
+template<typename X, typename Y>
+class MetSegmenter {
+    double epsilon;
+    double slope;
+    X x0{};
+    Y y0{};
+    bool empty = true;
+
+public:
+    MetSegmenter(double epsilon, double slope) : epsilon(epsilon), slope(slope) {}
+
+    bool add_point(X x, Y y) {
+        if (empty) {
+            x0 = x;
+            y0 = y;
+            empty = false;
+            return true;
+        }
+        if (std::fabs(double(y - y0) - slope * double(x - x0)) > epsilon) {
+            empty = true;
+            return false;
+        }
+        return true;
+    }
+
+    std::pair<double, double> get_slope_range() const { return {slope, slope}; }
+
+    void reset() { empty = true; }
+
+    size_t memory_usage() const { return sizeof(*this); }
+};
+
+/**
+ * The greedy shrinking cone algorithm of the FITing-tree: a segment starts at its first point, and keeps the range of
+ * slopes of the lines through that point which are within ε from all the other points of the segment.
+ */
+template<typename X, typename Y>
+class ShrinkingConeSegmenter {
+    double epsilon;
+    double x0 = 0;
+    double y0 = 0;
+    double slope_lo = 0;
+    double slope_hi = 0;
+    bool empty = true;
+
+public:
+    explicit ShrinkingConeSegmenter(double epsilon) : epsilon(epsilon) {}
+
+    bool add_point(X x, Y y) {
+        if (empty) {
+            x0 = x;
+            y0 = y;
+            slope_lo = 0;
+            slope_hi = std::numeric_limits<double>::infinity();
+            empty = false;
+            return true;
+        }
+
+        auto dx = double(x) - x0;
+        auto dy = double(y) - y0;
+        if (dx == 0) {
+            if (std::fabs(dy) > epsilon) {
+                empty = true;
+                return false;
+            }
+            return true;
+        }
+
+        auto slope = dy / dx;
+        if (slope < slope_lo || slope > slope_hi) {
+            empty = true;
+            return false;
+        }
+        slope_lo = std::max(slope_lo, (dy - epsilon) / dx);
+        slope_hi = std::min(slope_hi, (dy + epsilon) / dx);
+        return true;
+    }
+
+    std::pair<double, double> get_slope_range() const { return {slope_lo, slope_hi}; }
+
+    void reset() { empty = true; }
+
+    size_t memory_usage() const { return sizeof(*this); }
+};
+
+/**
+ * The swing filter: like the shrinking cone, but the segments are connected. A new segment starts from the end of the
+ * previous one, that is, from its line evaluated at the last point it covered, rather than from a point of the input.
+ */
+template<typename X, typename Y>
+class SwingFilterSegmenter {
+    double epsilon;
+    double anchor_x = 0;
+    double anchor_y = 0;
+    double last_x = 0;
+    double last_y = 0;
+    double slope_lo = 0;
+    double slope_hi = 0;
+    bool has_anchor = false;
+    bool empty = true;
+
+public:
+    explicit SwingFilterSegmenter(double epsilon) : epsilon(epsilon) {}
+
+    bool add_point(X x, Y y) {
+        if (!has_anchor) {
+            anchor_x = last_x = x;
+            anchor_y = last_y = y;
+            has_anchor = true;
+            empty = true;
+            return true;
+        }
+        if (empty) {
+            slope_lo = -std::numeric_limits<double>::infinity();
+            slope_hi = std::numeric_limits<double>::infinity();
+        }
+
+        auto dx = double(x) - anchor_x;
+        auto dy = double(y) - anchor_y;
+        if (dx == 0) {
+            if (std::fabs(dy) <= epsilon)
+                return true;
+            if (empty) {
+                // A segment cannot start with a vertical jump from the anchor, so restart from the point
+                anchor_y = y;
+                return true;
+            }
+        } else {
+            auto lo = std::max(slope_lo, (dy - epsilon) / dx);
+            auto hi = std::min(slope_hi, (dy + epsilon) / dx);
+            if (lo <= hi) {
+                slope_lo = lo;
+                slope_hi = hi;
+                last_x = x;
+                last_y = y;
+                empty = false;
+                return true;
+            }
+        }
+
+        // Close the segment with the feasible slope that ends closest to the last point, and move the anchor there
+        auto slope = std::clamp((last_y - anchor_y) / (last_x - anchor_x), slope_lo, slope_hi);
+        anchor_y += slope * (last_x - anchor_x);
+        anchor_x = last_x;
+        empty = true;
+        return false;
+    }
+
+    std::pair<double, double> get_slope_range() const { return {slope_lo, slope_hi}; }
+
+    void reset() {
+        has_anchor = false;
+        empty = true;
+    }
+
+    size_t memory_usage() const { return sizeof(*this); }
+};
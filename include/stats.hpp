@@ -17,7 +17,13 @@
 
 #pragma once
 
+#include <cmath>
+#include <memory>
 #include <random>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
 
 template<typename RealType=double>
 class pareto_distribution {
@@ -62,6 +68,130 @@ public:
     }
 };
 
+/**
+ * The empirical distribution of a sequence of samples, e.g. the gaps of a real dataset. Without a block length, values
+ * are drawn independently in O(1) time from an alias table built on the distinct samples. With a block length L > 1,
+ * values are drawn with a moving block bootstrap, i.e. by concatenating runs of L consecutive samples starting at
+ * random positions, which preserves the autocorrelation within a run. Copies share the (immutable) tables.
+ */
+template<typename RealType=double>
+class empirical_distribution {
+    struct Tables {
+        std::vector<RealType> samples;    ///< The samples in their original order (used only by the bootstrap).
+        std::vector<RealType> values;     ///< The distinct samples.
+        std::vector<uint32_t> threshold;  ///< The probability of keeping values[i] rather than its alias, in 2^-32 units.
+        std::vector<uint32_t> alias;      ///< The alias of each entry.
+        RealType mean;
+        RealType variance;
+    };
+
+    std::shared_ptr<const Tables> tables;
+    size_t block_length;
+    size_t block_position = 0;
+    size_t block_remaining = 0;
+
+    static std::shared_ptr<const Tables> make_tables(std::vector<RealType> &&samples, bool keep_samples) {
+        if (samples.empty())
+            throw std::invalid_argument("The empirical distribution needs at least one sample");
+
+        auto t = std::make_shared<Tables>();
+        auto n = samples.size();
+        t->mean = std::accumulate(samples.begin(), samples.end(), RealType(0)) / n;
+        t->variance = 0;
+        for (auto x : samples)
+            t->variance += (x - t->mean) * (x - t->mean);
+        t->variance /= n;
+
+        if (keep_samples) {
+            t->samples = std::move(samples);
+            return t;
+        }
+
+        // Vose's alias method on the distinct values, weighted by their frequency
+        std::sort(samples.begin(), samples.end());
+        std::vector<size_t> counts;
+        for (size_t i = 0; i < n; ++i) {
+            if (i == 0 || samples[i] != samples[i - 1]) {
+                t->values.push_back(samples[i]);
+                counts.push_back(0);
+            }
+            ++counts.back();
+        }
+        std::vector<RealType>().swap(samples);
+
+        auto k = t->values.size();
+        if (k > std::numeric_limits<uint32_t>::max())
+            throw std::invalid_argument("Too many distinct samples");
+
+        std::vector<double> scaled(k);
+        std::vector<uint32_t> small, large;
+        for (size_t i = 0; i < k; ++i) {
+            scaled[i] = double(counts[i]) * k / n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        t->threshold.assign(k, std::numeric_limits<uint32_t>::max());
+        t->alias.resize(k);
+        std::iota(t->alias.begin(), t->alias.end(), 0);
+        while (!small.empty() && !large.empty()) {
+            auto s = small.back();
+            auto l = large.back();
+            small.pop_back();
+            t->threshold[s] = uint32_t(scaled[s] * 4294967296.);
+            t->alias[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        return t;
+    }
+
+    template<class Generator>
+    static uint64_t random_bits(Generator &g) {
+        if constexpr (Generator::min() == 0 && Generator::max() >= std::numeric_limits<uint32_t>::max())
+            return uint32_t(g());
+        else
+            return std::uniform_int_distribution<uint32_t>()(g);
+    }
+
+public:
+    using result_type = RealType;
+
+    /**
+     * Constructs the distribution of the given samples.
+     * @param samples the samples
+     * @param block_length the length of the blocks of the bootstrap, or 0 to draw the samples independently
+     */
+    explicit empirical_distribution(std::vector<RealType> samples, size_t block_length = 0)
+        : tables(make_tables(std::move(samples), block_length > 1)),
+          block_length(std::min(block_length, tables->samples.size())) {}
+
+    RealType mean() const { return tables->mean; }
+
+    RealType variance() const { return tables->variance; }
+
+    template<class Generator>
+    RealType operator()(Generator &g) {
+        if (block_length > 1) {
+            if (block_remaining == 0) {
+                auto positions = tables->samples.size() - block_length + 1;
+                block_position = (random_bits(g) << 32 | random_bits(g)) % positions;
+                block_remaining = block_length;
+            }
+            --block_remaining;
+            return tables->samples[block_position++];
+        }
+
+        // Lemire's multiply-shift maps 32 random bits to an index, the other 32 bits choose between it and its alias
+        auto i = (random_bits(g) * tables->values.size()) >> 32;
+        auto j = random_bits(g) < tables->threshold[i] ? i : tables->alias[i];
+        return tables->values[j];
+    }
+};
+
 class RunningStat {
     size_t n;
     double m_oldM;
@@ -71,7 +201,11 @@ class RunningStat {
     double m_total;
 
 public:
-    RunningStat() : n(0) {}
+    RunningStat() : n(0), m_oldM(0), m_newM(0), m_oldS(0), m_newS(0), m_total(0) {}
+
+    /** Restores a statistic from the values returned by samples(), mean(), m2() and total(). */
+    RunningStat(size_t n, double mean, double m2, double total)
+        : n(n), m_oldM(mean), m_newM(mean), m_oldS(m2), m_newS(m2), m_total(total) {}
 
     void push(double x) {
         n++;
@@ -107,6 +241,28 @@ public:
     double total() const {
         return m_total;
     }
+
+    /** Returns the sum of the squared differences from the mean. */
+    double m2() const {
+        return (n > 0) ? m_oldS : 0.0;
+    }
+
+    /** Combines the samples of another statistic into this one (Chan et al. parallel algorithm). */
+    void merge(const RunningStat &other) {
+        if (other.n == 0)
+            return;
+        if (n == 0) {
+            *this = other;
+            return;
+        }
+
+        auto count = n + other.n;
+        auto delta = other.mean() - mean();
+        m_oldM = m_newM = mean() + delta * other.n / count;
+        m_oldS = m_newS = m2() + other.m2() + delta * delta * n * other.n / count;
+        m_total += other.m_total;
+        n = count;
+    }
 };
 
 template<typename Dist>
@@ -142,5 +298,8 @@ std::pair<typename Dist::result_type, typename Dist::result_type> get_moments(Di
     if constexpr (std::is_same<Dist, laplace_distribution<T>>::value)
         return {d.loc, 2. * d.scale * d.scale};
 
+    if constexpr (std::is_same<Dist, empirical_distribution<T>>::value)
+        return {d.mean(), d.variance()};
+
     throw std::invalid_argument("Unknown distribution");
 }
@@ -0,0 +1,184 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include "piecewise_linear_model.hpp"
+
+/**
+ * A set of keys indexed by the segments of OptimalPiecewiseLinearModel that supports insertions.
+ *
+ * Each segment owns the sorted keys it covers and a single small sorted insert buffer. An insertion goes to the buffer
+ * of the segment covering the key. When a buffer is full, it is merged with the keys of its segment, and only this
+ * merged range is segmented again with OPT, replacing the segment with one or more new segments. This is a simplified
+ * log-structured merge with one buffer per segment, rather than a hierarchy of levels of growing size. A lookup
+ * predicts the position of the key in its segment with the linear model, searches the keys within ±ε of that position,
+ * and then the buffer.
+ */
+template<typename K>
+class UpdatableSegmentation {
+    struct Segment {
+        K key;                 ///< The smallest key routed to this segment.
+        K origin;              ///< The first key of the model, which predicts the position of key k as
+        double slope;          ///< slope * (k - origin) + intercept.
+        double intercept;
+        std::vector<K> keys;   ///< The keys covered by the model, sorted.
+        std::vector<K> buffer; ///< The keys inserted since the last merge, sorted.
+    };
+
+    size_t epsilon;
+    size_t buffer_capacity;
+    OptimalPiecewiseLinearModel<double, double> opt;
+    std::vector<Segment> segments;
+    size_t n = 0;
+    size_t resegmentations_ = 0;
+    size_t resegmented_keys_ = 0;
+    double resegmentation_seconds_ = 0;
+
+    /** Segments the given sorted keys with OPT and appends the resulting segments to out. */
+    void build(const std::vector<K> &keys, std::vector<Segment> &out) {
+        auto add_segment = [&](size_t begin, size_t end, double slope, double intercept) {
+            Segment s;
+            s.key = s.origin = keys[begin];
+            s.slope = slope;
+            s.intercept = intercept;
+            s.keys.assign(keys.begin() + begin, keys.begin() + end);
+            out.push_back(std::move(s));
+        };
+
+        // Each segment is fed to OPT with its first key as the origin, so the model stops at the key closing it
+        size_t start = 0;
+        while (start < keys.size()) {
+            opt.reset();
+            auto n = keys.size() - start;
+            auto on_segment = [&](size_t i, double slope, double intercept) {
+                add_segment(start, start + i, slope, intercept);
+                return false;
+            };
+            auto added = opt.add_keys(keys.data() + start, keys[start], 0., n, on_segment);
+            if (added == n) {
+                auto[slope, intercept] = opt.get_segment();
+                add_segment(start, keys.size(), slope, intercept);
+            }
+            start += added;
+        }
+    }
+
+    size_t find_segment(const K &key) const {
+        auto it = std::upper_bound(segments.begin(), segments.end(), key,
+                                   [](const K &k, const Segment &s) { return k < s.key; });
+        return it == segments.begin() ? 0 : std::distance(segments.begin(), it) - 1;
+    }
+
+    bool contains_in_keys(const Segment &s, const K &key) const {
+        if (s.keys.empty())
+            return false;
+        auto p = key < s.origin ? 0. : s.slope * double(key - s.origin) + s.intercept;
+        auto pos = std::min(p > 0 ? size_t(p) : 0, s.keys.size() - 1);
+        auto lo = s.keys.begin() + (pos > epsilon ? pos - epsilon : 0);
+        auto hi = s.keys.begin() + std::min(pos + epsilon + 2, s.keys.size());
+        return std::binary_search(lo, hi, key);
+    }
+
+    void merge_buffer(size_t i) {
+        auto begin = std::chrono::steady_clock::now();
+
+        auto &s = segments[i];
+        std::vector<K> merged;
+        merged.reserve(s.keys.size() + s.buffer.size());
+        std::merge(s.keys.begin(), s.keys.end(), s.buffer.begin(), s.buffer.end(), std::back_inserter(merged));
+        auto routing_key = s.key;
+
+        std::vector<Segment> replacement;
+        build(merged, replacement);
+        replacement.front().key = routing_key;
+        segments[i] = std::move(replacement.front());
+        segments.insert(segments.begin() + i + 1, std::make_move_iterator(replacement.begin() + 1),
+                        std::make_move_iterator(replacement.end()));
+
+        auto end = std::chrono::steady_clock::now();
+        ++resegmentations_;
+        resegmented_keys_ += merged.size();
+        resegmentation_seconds_ += std::chrono::duration<double>(end - begin).count();
+    }
+
+public:
+
+    /**
+     * Builds the structure on the given keys.
+     * @param keys the keys, sorted and without duplicates
+     * @param epsilon the maximum error of the segments
+     * @param buffer_capacity the number of insertions in a segment that trigger its re-segmentation
+     */
+    UpdatableSegmentation(const std::vector<K> &keys, size_t epsilon, size_t buffer_capacity)
+        : epsilon(epsilon),
+          buffer_capacity(std::max<size_t>(buffer_capacity, 1)),
+          opt(epsilon, epsilon),
+          n(keys.size()) {
+        build(keys, segments);
+    }
+
+    /** Returns true if the key is in the set. */
+    bool contains(const K &key) const {
+        if (segments.empty())
+            return false;
+        auto &s = segments[find_segment(key)];
+        return contains_in_keys(s, key) || std::binary_search(s.buffer.begin(), s.buffer.end(), key);
+    }
+
+    /** Inserts the key, returning false if it was already in the set. */
+    bool insert(const K &key) {
+        if (segments.empty()) {
+            std::vector<K> keys{key};
+            build(keys, segments);
+            n = 1;
+            return true;
+        }
+
+        auto i = find_segment(key);
+        auto &s = segments[i];
+        if (contains_in_keys(s, key))
+            return false;
+        auto it = std::lower_bound(s.buffer.begin(), s.buffer.end(), key);
+        if (it != s.buffer.end() && *it == key)
+            return false;
+
+        s.buffer.insert(it, key);
+        s.key = std::min(s.key, key);
+        ++n;
+        if (s.buffer.size() >= buffer_capacity)
+            merge_buffer(i);
+        return true;
+    }
+
+    size_t size() const { return n; }
+
+    size_t segments_count() const { return segments.size(); }
+
+    /** Returns the number of times that a buffer was merged and its segment was segmented again. */
+    size_t resegmentations() const { return resegmentations_; }
+
+    /** Returns the total number of keys processed by the re-segmentations. */
+    size_t resegmented_keys() const { return resegmented_keys_; }
+
+    /** Returns the total time spent in re-segmentations. */
+    double resegmentation_seconds() const { return resegmentation_seconds_; }
+};
@@ -0,0 +1,103 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include "args.hxx"
+#include "common.hpp"
+
+int main(int argc, char **argv) {
+    args::ArgumentParser p("Merge the partial outputs of simulate --shard k/N into the final csv");
+    args::HelpFlag help(p, "help", "Display this help menu", {'h', "help"});
+    args::PositionalList<std::string> paths(p, "files", "The outputs of the N shards", args::Options::Required);
+
+    try {
+        p.ParseCLI(argc, argv);
+    }
+    catch (args::Help) {
+        std::cout << p;
+        return 0;
+    }
+    catch (args::Error &e) {
+        std::cerr << e.what() << std::endl << p;
+        return 1;
+    }
+
+    std::optional<ExitTimeStats> merged;
+    std::vector<std::string> common_comments;
+    std::vector<bool> seen;
+
+    for (auto &&path : paths) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+
+        try {
+            std::vector<std::string> lines;
+            auto stats = ExitTimeStats::read_partial(in, lines);
+
+            size_t shard = 0, n_shards = 0;
+            std::vector<std::string> comments;
+            for (auto &line : lines) {
+                if (line.rfind("# shard ", 0) == 0)
+                    std::sscanf(line.c_str(), "# shard %zu/%zu", &shard, &n_shards);
+                else
+                    comments.push_back(line);
+            }
+
+            if (!merged) {
+                seen.resize(n_shards);
+                common_comments = comments;
+                merged = stats;
+            } else {
+                if (comments != common_comments)
+                    throw std::runtime_error("the shard was run with a different configuration");
+                merged->merge(stats);
+            }
+
+            if (n_shards != seen.size() || shard >= n_shards)
+                throw std::runtime_error("invalid or inconsistent \"# shard\" line");
+            if (seen[shard])
+                throw std::runtime_error("shard " + std::to_string(shard) + " was given more than once");
+            seen[shard] = true;
+        }
+        catch (std::exception &e) {
+            std::cerr << path << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < seen.size(); ++i) {
+        if (!seen[i]) {
+            std::cerr << "Missing shard " << i << "/" << seen.size() << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout.precision(17);
+    for (auto &line : common_comments)
+        std::cout << line << std::endl;
+    merged->write_csv(std::cout);
+
+    return 0;
+}
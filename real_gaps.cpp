@@ -19,76 +19,413 @@
 #include <chrono>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <type_traits>
 #include <cstring>
 #include <algorithm>
 #include "args.hxx"
 #include "stats.hpp"
 #include "common.hpp"
+#include "block_reader.hpp"
+#include "segment_file.hpp"
+#include "numa.hpp"
+#include "datasets.hpp"
+#include "segmenters.hpp"
 
-template<typename TypeOut>
-std::vector<TypeOut> read_dataset_csv(const std::string &filename) {
-    std::vector<TypeOut> dataset;
+struct SegmentationConfig {
+    size_t min_epsilon;
+    size_t max_epsilon;
+    size_t threads;
+    bool binary_files;
+    bool streaming;
+    size_t block_size;
+    bool numa;
+    bool compare;
+    std::string segments_directory;
+    size_t epsilon_recursive;
+    size_t page_size;
+};
 
-    try {
-        std::fstream in(filename);
-        in.exceptions(std::ios::failbit | std::ios::badbit);
-        std::string line;
-
-        while (in.peek() != EOF && std::getline(in, line)) {
-            TypeOut value;
-            std::stringstream stringstream(line);
-            stringstream >> value;
-            dataset.push_back(value);
+/** Returns the distance of a key from the first key, computed in the key type if it is an integer. */
+template<typename K>
+double key_offset(K key, K first_key) {
+    if constexpr (std::is_integral_v<K>)
+        return double(key - first_key);
+    else
+        return double(key) - double(first_key);
+}
+
+/**
+ * The upper levels of a recursive index, built while the segments of the level below are closed. Each level is
+ * segmented with OPT on the first keys of the segments of the level below as they arrive, so that only the segments
+ * count of each level is kept. A new level is started when the topmost one gets its second segment.
+ */
+template<typename K>
+class UpperLevels {
+    struct Level {
+        OptimalPiecewiseLinearModel<double, double> opt;
+        K first_key;
+        uint64_t keys = 0;
+        uint64_t segments = 0;
+
+        Level(size_t epsilon, K first_key) : opt(epsilon, epsilon, 64), first_key(first_key) {}
+    };
+
+    size_t epsilon;
+    std::vector<Level> levels;
+    uint64_t bottom_segments = 0;
+    K bottom_first_key{};
+
+    void add_key(size_t l, K key) {
+        if (l == levels.size())
+            levels.emplace_back(epsilon, key);
+
+        auto &level = levels[l];
+        auto x = key_offset(key, level.first_key);
+        auto y = level.keys++;
+        if (level.opt.add_point(x, y)) {
+            if (y > 0)
+                return;
+        } else
+            level.opt.add_point(x, y);
+
+        // The key starts a new segment of this level, which is added to the level above
+        auto first_key = level.first_key;
+        auto segments = ++level.segments;
+        if (segments == 2)
+            add_key(l + 1, first_key);
+        if (segments >= 2)
+            add_key(l + 1, key);
+    }
+
+public:
+
+    explicit UpperLevels(size_t epsilon) : epsilon(epsilon) {}
+
+    /** Adds the first key of a new segment of the bottom level. */
+    void add_segment(K key) {
+        if (++bottom_segments == 1) {
+            bottom_first_key = key;
+            return;
         }
+        if (bottom_segments == 2)
+            add_key(0, bottom_first_key);
+        add_key(0, key);
     }
-    catch (std::ios_base::failure &e) {
-        std::cerr << e.what() << std::endl;
-        std::cerr << std::strerror(errno) << std::endl;
-        exit(1);
+
+    /** Returns the number of levels above the bottom one. */
+    size_t size() const { return levels.size(); }
+
+    /** Returns the total number of segments of the levels above the bottom one. */
+    uint64_t segments_count() const {
+        uint64_t count = 0;
+        for (auto &level : levels)
+            count += level.segments;
+        return count;
+    }
+};
+
+/**
+ * Segments the points (x, y), where x = key - first_key and y is the rank of key minus one, with the OPT algorithm.
+ * Keeps the statistics on the length of the segments and the segments themselves.
+ *
+ * As in the original experiment, the point that does not fit in a segment is skipped and the next point starts a new
+ * segment. If keep_segments is true, the segments are kept to be written to a segment file, and the skipped point
+ * starts the new segment instead, so that every key is within ε of the position predicted by its segment. Otherwise,
+ * only the statistics and the upper levels of the index are kept, and the memory does not depend on the number of keys.
+ */
+template<typename K>
+class OptSegmentation {
+    OptimalPiecewiseLinearModel<double, double> opt;
+    K first_key;
+    K start_key;
+    uint64_t start = 0;
+    uint64_t points = 0;
+    uint64_t segments_count_ = 0;
+    bool keep_segments;
+    bool open = false;
+    bool finished = false;
+
+    void open_segment(K key) {
+        start_key = key;
+        open = true;
+        ++segments_count_;
+        upper_levels.add_segment(key);
+    }
+
+    void save_segment(double slope, double intercept) {
+        if (keep_segments)
+            segments.push_back({start_key, slope, intercept + 1});
     }
 
-    return dataset;
+public:
+    RunningStat stat;
+    UpperLevels<K> upper_levels;
+    std::vector<Segment<K>> segments;
+    double seconds = 0; ///< The time spent in building the segments, measured by the caller.
+
+    OptSegmentation(size_t epsilon, size_t epsilon_recursive, K first_key, bool keep_segments)
+        : opt(epsilon, epsilon),
+          first_key(first_key),
+          start_key(first_key),
+          keep_segments(keep_segments),
+          upper_levels(epsilon_recursive) {}
+
+    /** Adds the points (keys[i] - first_key, first_y + i) for i = 0, ..., n-1. The keys must be sorted and distinct. */
+    void add_points(const K *keys, uint64_t first_y, size_t n) {
+        points += n;
+        while (n > 0) {
+            if (!open)
+                open_segment(keys[0]);
+
+            auto added = opt.add_keys(keys, first_key, first_y, n, [&](size_t i, double slope, double intercept) {
+                stat.push(first_y + i - start);
+                save_segment(slope, intercept);
+                start = first_y + i;
+                if (!keep_segments)
+                    return false;
+                open_segment(keys[i]);
+                return true;
+            });
+            if (added == n)
+                return;
+
+            // Skip the point that closed the segment
+            open = false;
+            keys += added + 1;
+            first_y += added + 1;
+            n -= added + 1;
+        }
+    }
+
+    /** Closes the last segment. */
+    void finish() {
+        if (open && !finished) {
+            auto[slope, intercept] = opt.get_segment();
+            save_segment(slope, intercept);
+        }
+        finished = true;
+    }
+
+    /** Returns the number of segments of the bottom level. */
+    uint64_t segments_count() const {
+        return segments_count_;
+    }
+
+    /** Returns the number of keys, that is the first key, which has rank 0 and it is not a point, plus the points. */
+    uint64_t keys_count() const {
+        return points + 1;
+    }
+
+    /** Writes all the segments to the given file. */
+    void write(const std::string &filename, size_t epsilon) {
+        finish();
+        try {
+            write_segment_file(filename, epsilon, keys_count(), segments);
+        }
+        catch (std::ios_base::failure &e) {
+            std::cerr << filename << ": " << e.what() << std::endl;
+            std::cerr << std::strerror(errno) << std::endl;
+            exit(1);
+        }
+    }
+};
+
+std::string segment_filename(const std::string &directory, const std::string &name, size_t epsilon) {
+    return directory + "/" + name + ".eps" + std::to_string(epsilon) + ".seg";
 }
 
-template<typename TypeIn, typename TypeOut>
-std::vector<TypeOut> read_data_binary(const std::string &filename, bool first_is_size = true) {
-    try {
-        auto openmode = std::ios::in | std::ios::binary;
-        if (!first_is_size)
-            openmode |= std::ios::ate;
-
-        std::fstream in(filename, openmode);
-        in.exceptions(std::ios::failbit | std::ios::badbit);
-
-        size_t size = 0;
-        if (first_is_size)
-            in.read((char *) &size, sizeof(TypeIn));
-        else {
-            size = static_cast<size_t>(in.tellg() / sizeof(TypeIn));
-            in.seekg(0);
+/**
+ * Returns the bytes of the inner nodes of a B+-tree whose leaves are pages holding the given number of keys. An inner
+ * node is a page with a key and a pointer per child.
+ */
+uint64_t btree_index_bytes(uint64_t n_keys, uint64_t key_size, uint64_t page_size) {
+    auto leaf_capacity = std::max<uint64_t>(page_size / key_size, 1);
+    auto fanout = std::max<uint64_t>(page_size / (key_size + sizeof(void *)), 2);
+    auto nodes = (n_keys + leaf_capacity - 1) / leaf_capacity;
+    uint64_t bytes = 0;
+    while (nodes > 1) {
+        nodes = (nodes + fanout - 1) / fanout;
+        bytes += nodes * page_size;
+    }
+    return bytes;
+}
+
+/** Optionally writes the segments of the bottom level to a file, and returns the row of the csv output. */
+template<typename K>
+std::string report(const std::string &name, uint64_t dataset_size, size_t epsilon, OptSegmentation<K> &segmentation,
+                   const SegmentationConfig &cfg) {
+    segmentation.finish();
+    auto levels = 1 + segmentation.upper_levels.size();
+    auto index_segments = segmentation.segments_count() + segmentation.upper_levels.segments_count();
+    auto seconds = segmentation.seconds;
+
+    if (!cfg.segments_directory.empty())
+        segmentation.write(segment_filename(cfg.segments_directory, name, epsilon), epsilon);
+
+    constexpr auto segment_bytes = sizeof(K) + 2 * sizeof(double);
+    auto n_keys = segmentation.keys_count();
+    // The worst case of the keys searched by a lookup, that is, the ±ε range of a segment summed over all levels
+    auto max_search_range = (2 * epsilon + 1) + (levels - 1) * (2 * cfg.epsilon_recursive + 1);
+    auto &stat = segmentation.stat;
+
+    std::stringstream row;
+    row << name << "," << dataset_size << "," << epsilon << "," << stat.mean() << "," << stat.standard_deviation()
+        << "," << stat.samples() << "," << levels << "," << index_segments * segment_bytes << ","
+        << btree_index_bytes(n_keys, sizeof(K), cfg.page_size) << "," << max_search_range << "," << seconds << ","
+        << (seconds > 0 ? n_keys / seconds : 0.) << std::endl;
+    return row.str();
+}
+
+template<typename K>
+void segment_sorted_stream(const std::string &path, const std::string &name, const SegmentationConfig &cfg) {
+    BlockReader<K> reader(path, cfg.block_size);
+    auto n_epsilon_values = cfg.max_epsilon > cfg.min_epsilon ? cfg.max_epsilon - cfg.min_epsilon : 0;
+    std::vector<OptSegmentation<K>> segmentations;
+
+    std::vector<K> distinct_keys(cfg.block_size);
+    K first_key = 0;
+    K previous_key = 0;
+    uint64_t y_begin = 0;
+    bool empty = true;
+
+    size_t length;
+    for (auto keys = reader.next(length); length > 0; keys = reader.next(length)) {
+        // Copy the keys of the block, skipping duplicates
+        size_t m = 0;
+        for (size_t i = 0; i < length; ++i) {
+            auto key = keys[i];
+            if (empty) {
+                first_key = previous_key = key;
+                empty = false;
+                for (auto eps = cfg.min_epsilon; eps < cfg.max_epsilon; ++eps)
+                    segmentations.emplace_back(eps, cfg.epsilon_recursive, first_key,
+                                               !cfg.segments_directory.empty());
+                continue;
+            }
+            if (key < previous_key) {
+                std::cerr << name << " is not sorted" << std::endl;
+                exit(1);
+            }
+            if (key != previous_key)
+                distinct_keys[m++] = key;
+            previous_key = key;
         }
 
-        std::vector<TypeIn> data(size);
-        in.read((char *) data.data(), size * sizeof(TypeIn));
-        if constexpr (std::is_same<TypeIn, TypeOut>::value)
-            return data;
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(cfg.threads)
+        for (size_t e = 0; e < n_epsilon_values; ++e) {
+            auto &segmentation = segmentations[e];
+            auto begin = std::chrono::steady_clock::now();
+            segmentation.add_points(distinct_keys.data(), y_begin, m);
+            auto end = std::chrono::steady_clock::now();
+            segmentation.seconds += std::chrono::duration<double>(end - begin).count();
+        }
 
-        return std::vector<TypeOut>(data.begin(), data.end());
+        y_begin += m;
     }
-    catch (std::ios_base::failure &e) {
-        std::cerr << e.what() << std::endl;
-        std::cerr << std::strerror(errno) << std::endl;
-        exit(1);
+
+    for (size_t e = 0; e < segmentations.size(); ++e)
+        std::cout << report(name, y_begin, e + cfg.min_epsilon, segmentations[e], cfg);
+}
+
+template<typename K>
+void compare_segmenters(const std::string &name, const std::vector<K> &keys, const SegmentationConfig &cfg) {
+    auto n = keys.size() - 1;
+    auto slope = n / key_offset(keys.back(), keys.front());
+
+    #pragma omp parallel for ordered schedule(static, 1) num_threads(cfg.threads)
+    for (auto eps = cfg.min_epsilon; eps < cfg.max_epsilon; ++eps) {
+        std::stringstream rows;
+        rows.precision(6);
+
+        auto measure = [&](const char *algorithm, auto segmenter) {
+            auto begin = std::chrono::steady_clock::now();
+            size_t segments = n > 0;
+            for (uint64_t y = 0; y < n; ++y) {
+                auto x = key_offset(keys[y + 1], keys[0]);
+                if (!segmenter.add_point(x, y)) {
+                    ++segments;
+                    segmenter.add_point(x, y);
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+            auto seconds = std::chrono::duration<double>(end - begin).count();
+
+            rows << name << "," << n << "," << eps << "," << algorithm << "," << segments << "," << seconds << ","
+                 << n / seconds << "," << segmenter.memory_usage() << std::endl;
+        };
+
+        measure("opt", OptimalPiecewiseLinearModel<double, double>(eps, eps));
+        measure("met", MetSegmenter<double, double>(eps, slope));
+        measure("cone", ShrinkingConeSegmenter<double, double>(eps));
+        measure("swing", SwingFilterSegmenter<double, double>(eps));
+
+        #pragma omp ordered
+        std::cout << rows.str() << std::flush;
     }
 }
 
-template<typename V>
-void sort_and_replace_with_gaps(V &dataset) {
-    std::sort(dataset.begin(), dataset.end());
-    dataset.erase(std::unique(dataset.begin(), dataset.end()), dataset.end());
-    for (auto i = 0; i < dataset.size() - 1; ++i)
-        dataset[i] = dataset[i + 1] - dataset[i];
-    dataset.pop_back();
+/** Segments the given dataset, whose keys have type K, for each value of ε and prints the rows of the csv output. */
+template<typename K>
+void segment_dataset(const std::string &path, const SegmentationConfig &cfg) {
+    auto name = path.substr(path.find_last_of("/\\") + 1);
+    if (cfg.streaming) {
+        segment_sorted_stream<K>(path, name, cfg);
+        return;
+    }
+
+    std::vector<K> dataset;
+    if (cfg.binary_files)
+        dataset = read_data_binary<K, K>(path);
+    else
+        dataset = read_dataset_csv<K>(path);
+    sort_and_deduplicate(dataset);
+    if (dataset.empty())
+        return;
+    if (cfg.compare) {
+        compare_segmenters(name, dataset, cfg);
+        return;
+    }
+
+    auto n = dataset.size() - 1;
+    auto nodes = cfg.numa ? numa_nodes() : std::vector<std::vector<int>>(1);
+    std::vector<std::unique_ptr<K[]>> replicas(nodes.size());
+    std::vector<const K *> node_keys(nodes.size(), dataset.data());
+
+    #pragma omp parallel num_threads(cfg.threads)
+    {
+        auto node = numa_node_of_thread(thread_index(), team_size(), nodes.size());
+        if (nodes.size() > 1) {
+            pin_current_thread(nodes[node]);
+
+            // The first thread of each node copies the keys, so that the pages are allocated on its node
+            if (thread_index() == 0 || numa_node_of_thread(thread_index() - 1, team_size(), nodes.size()) != node) {
+                replicas[node].reset(new K[n + 1]);
+                std::copy(dataset.begin(), dataset.end(), replicas[node].get());
+                node_keys[node] = replicas[node].get();
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            std::vector<K>().swap(dataset);
+        } else if (cfg.numa)
+            pin_current_thread(nodes[node]);
+
+        auto keys = node_keys[node];
+
+        #pragma omp for ordered schedule(static, 1)
+        for (auto eps = cfg.min_epsilon; eps < cfg.max_epsilon; ++eps) {
+            OptSegmentation<K> segmentation(eps, cfg.epsilon_recursive, keys[0], !cfg.segments_directory.empty());
+            auto begin = std::chrono::steady_clock::now();
+            segmentation.add_points(keys + 1, 0, n);
+            auto end = std::chrono::steady_clock::now();
+            segmentation.seconds = std::chrono::duration<double>(end - begin).count();
+
+            auto row = report(name, n, eps, segmentation, cfg);
+            #pragma omp ordered
+            std::cout << row << std::flush;
+        }
+    }
 }
 
 int main(int argc, char **argv) {
@@ -99,6 +436,24 @@ int main(int argc, char **argv) {
     args::ValueFlag<size_t> threads(p, "threads", "Number of threads", {'t'}, 4);
     args::Flag binary_files(p, "binary", "Interpret the input files as binary files rather than "
                                          "text files with numbers separated by newlines", {'b'});
+    args::ValueFlag<std::string> key_type(p, "type", "Type of the keys: uint32, uint64, float or double",
+                                          {"key-type"}, "uint64");
+    args::Flag streaming(p, "stream", "Segment binary files that are already sorted block by block, "
+                                      "in bounded memory", {"stream"});
+    args::ValueFlag<size_t> block_size(p, "block_size", "Number of keys read at once with --stream", {"block"},
+                                       size_t(1) << 22);
+    args::Flag numa(p, "numa", "Pin the threads to NUMA nodes and give each node its own copy of the data (not "
+                               "available with --stream or --compare)", {"numa"});
+    args::Flag compare(p, "compare", "Compare the number of segments, the build throughput and the memory of the OPT, "
+                                     "MET, shrinking cone and swing filter algorithms", {"compare"});
+    args::ValueFlag<std::string> segments_directory(p, "directory", "Write the segments of each ε to a binary file "
+                                                                    "in this directory. The key that does not fit in "
+                                                                    "a segment then starts the next one rather than "
+                                                                    "being skipped", {"segments"});
+    args::ValueFlag<size_t> epsilon_recursive(p, "epsilon_recursive", "Value of ε of the upper levels of the index",
+                                              {"epsilon-recursive"}, 4);
+    args::ValueFlag<size_t> page_size(p, "bytes", "Page size of the B+-tree the index is compared to",
+                                      {"page-size"}, 4096);
 
     try {
         p.ParseCLI(argc, argv);
@@ -112,35 +467,48 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    std::cout << "dataset,dataset_size,epsilon,opt_avg,opt_std,samples" << std::endl;
+    if (streaming && !binary_files) {
+        std::cerr << "--stream requires binary files (-b)" << std::endl;
+        return 1;
+    }
+
+    if (streaming && compare) {
+        std::cerr << "--compare cannot be used with --stream" << std::endl;
+        return 1;
+    }
+
+    if (numa && (streaming || compare)) {
+        std::cerr << "--numa cannot be used with --stream or --compare" << std::endl;
+        return 1;
+    }
+
+    auto type = key_type.Get();
+    if (type != "uint32" && type != "uint64" && type != "float" && type != "double") {
+        std::cerr << "Unknown key type " << type << ", expected uint32, uint64, float or double" << std::endl;
+        return 1;
+    }
+
+    if (compare)
+        std::cout << "dataset,dataset_size,epsilon,algorithm,segments,build_seconds,keys_per_second,memory_bytes"
+                  << std::endl;
+    else
+        std::cout << "dataset,dataset_size,epsilon,opt_avg,opt_std,samples,"
+                     "levels,index_bytes,btree_bytes,max_search_range,build_seconds,keys_per_second" << std::endl;
+
+    SegmentationConfig cfg{min_epsilon.Get(), max_epsilon.Get(), threads.Get(), binary_files.Get(), streaming.Get(),
+                           block_size.Get(), numa.Get(), compare.Get(), segments_directory.Get(),
+                           std::max<size_t>(epsilon_recursive.Get(), 1), page_size.Get()};
 
     for (auto &&path : paths) {
-        auto name = path.substr(path.find_last_of("/\\") + 1);
-        std::vector<uint64_t> dataset;
-        if (binary_files.Get())
-            dataset = read_data_binary<uint64_t, uint64_t>(path);
+        if (type == "uint32")
+            segment_dataset<uint32_t>(path, cfg);
+        else if (type == "uint64")
+            segment_dataset<uint64_t>(path, cfg);
+        else if (type == "float")
+            segment_dataset<float>(path, cfg);
         else
-            dataset = read_dataset_csv<uint64_t>(path);
-        sort_and_replace_with_gaps(dataset);
-
-        #pragma omp parallel for ordered schedule(static, 1) num_threads(threads.Get())
-        for (auto eps = min_epsilon.Get(); eps < max_epsilon.Get(); ++eps) {
-            OptimalPiecewiseLinearModel<double, double> opt(eps, eps);
-            RunningStat stat;
-            uint64_t x = 0;
-            for (uint64_t y = 0, start = 0; y < dataset.size(); ++y) {
-                x += dataset[y];
-                if (!opt.add_point(x, y)) {
-                    stat.push(y - start);
-                    start = y;
-                }
-            }
-
-            #pragma omp ordered
-            std::cout << name << "," << dataset.size() << "," << eps << "," << stat.mean() << ","
-                      << stat.standard_deviation() << "," << stat.samples() << std::endl;
-        }
+            segment_dataset<double>(path, cfg);
     }
 
     return 0;
-}
\ No newline at end of file
+}
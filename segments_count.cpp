@@ -16,29 +16,56 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <tuple>
+#include <mutex>
+#include <vector>
 #include <random>
 #include <chrono>
 #include <iostream>
+#include <algorithm>
 #include "args.hxx"
 #include "stats.hpp"
 #include "common.hpp"
+#include "segmenters.hpp"
+#include "numa.hpp"
+#include "progress.hpp"
 
 template<typename Rng>
-void run_experiment(Rng &gap_distribution, size_t epsilon, size_t n, size_t step, size_t iterations, size_t threads) {
-    size_t progress = 0;
-    auto begin = std::chrono::steady_clock::now();
+void run_experiment(Rng &gap_distribution, const std::vector<size_t> &epsilons, bool opt, size_t n, size_t step,
+                    size_t iterations, size_t threads, const std::string &metrics_socket) {
     auto[mean, variance] = get_moments(gap_distribution);
     auto theoretical_slope = 1 / mean;
 
-    std::vector<RunningStat> segments(n / step + 1);
+    auto n_checkpoints = n / step + 1;
+
+    // Each thread accumulates into its own statistics, which are merged when the output is needed
+    struct alignas(64) ThreadStats {
+        std::mutex mutex;
+        std::vector<RunningStat> segments;
+    };
+    std::vector<ThreadStats> thread_stats(threads);
+
+    auto get_segments = [&] {
+        std::vector<RunningStat> segments(epsilons.size() * n_checkpoints);
+        for (auto &t : thread_stats) {
+            std::lock_guard<std::mutex> lock(t.mutex);
+            for (size_t j = 0; j < t.segments.size(); ++j)
+                segments[j].merge(t.segments[j]);
+        }
+        return segments;
+    };
 
     auto get_output = [&] {
+        auto segments = get_segments();
         std::stringstream s;
         s.precision(17);
-        s << "n,segments_avg,segments_std" << std::endl;
-        s << 1 << "," << segments[0].mean() << "," << segments[0].standard_deviation() << std::endl;
-        for (size_t i = 1; i < segments.size(); ++i)
-            s << i * step << "," << segments[i].mean() << "," << segments[i].standard_deviation() << std::endl;
+        s << "n,epsilon,segments_avg,segments_std" << std::endl;
+        for (size_t e = 0; e < epsilons.size(); ++e) {
+            auto *stats = &segments[e * n_checkpoints];
+            s << 1 << "," << epsilons[e] << "," << stats[0].mean() << "," << stats[0].standard_deviation() << std::endl;
+            for (size_t i = 1; i < n_checkpoints; ++i)
+                s << i * step << "," << epsilons[e] << "," << stats[i].mean() << "," << stats[i].standard_deviation()
+                  << std::endl;
+        }
         return s;
     };
 
@@ -48,60 +75,89 @@ void run_experiment(Rng &gap_distribution, size_t epsilon, size_t n, size_t step
     std::cout.precision(17);
     std::cout << "# mean " << mean << std::endl
               << "# variance " << variance << std::endl
-              << "# epsilon " << epsilon << std::endl
+              << "# algorithm " << (opt ? "OPT" : "MET") << std::endl
               << "# met constant " << mean * mean / variance << std::endl;
 
-    #pragma omp parallel for default(none) num_threads(threads) \
-            shared(gap_distribution, epsilon, n, step, iterations, threads, get_output, backup_output, \
-                   segments, theoretical_slope, progress, begin, std::cerr)
-    for (size_t i = 0; i < iterations; ++i) {
-        std::vector<size_t> checkpoints(segments.size());
-        checkpoints[0] = 1;
+    auto get_metrics = [&](std::ostream &s) {
+        auto segments = get_segments();
+        for (size_t e = 0; e < epsilons.size(); ++e)
+            s << "samples{epsilon=\"" << epsilons[e] << "\"} " << segments[e * n_checkpoints].samples() << "\n";
+    };
+    ProgressReporter reporter(iterations, threads, get_output, get_metrics, metrics_socket);
+
+    #pragma omp parallel num_threads(threads)
+    {
+        auto &local = thread_stats[thread_index()];
+        {
+            std::lock_guard<std::mutex> lock(local.mutex);
+            local.segments.resize(epsilons.size() * n_checkpoints);
+        }
+
+        // Per-thread state, reused across all the streams generated by this thread
+        std::vector<size_t> checkpoints(local.segments.size());
+        std::vector<size_t> counts(epsilons.size());
+        std::vector<OptimalPiecewiseLinearModel<double, double>> opt_models;
+        std::vector<MetSegmenter<double, double>> met_models;
+        for (auto eps : epsilons) {
+            if (opt)
+                opt_models.emplace_back(eps, eps);
+            else
+                met_models.emplace_back(eps, theoretical_slope);
+        }
 
         std::random_device rd;
         std::mt19937 gen(rd());
-        double x = 0;
-        size_t c = 1;
-        size_t start = 0;
-        for (uint64_t j = 1; j <= n; ++j) {
-            x += gap_distribution(gen);
-            if (std::fabs((j - start) - theoretical_slope * x) > epsilon) {
-                ++c;
-                x = 0;
-                start = j;
+        auto dist = gap_distribution;
+
+        auto generate_stream = [&](auto &models) {
+            for (auto &m : models) {
+                m.reset();
+                m.add_point(0, 0);
             }
-            if (j % step == 0)
-                checkpoints[j / step] = c;
-        }
 
-        #pragma omp critical
-        for (size_t j = 0; j < segments.size(); ++j)
-            segments[j].push(checkpoints[j]);
-
-        #pragma atomic
-        ++progress;
-        if (iterations > 1000 && progress % (iterations / 1000) == 0) {
-            auto current = std::chrono::steady_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(current - begin).count();
-            auto seconds_left = iterations * elapsed / progress - elapsed;
-            std::stringstream stream;
-            stream.precision(3);
-            stream << "\33[2K\r" << 100. * progress / iterations
-                   << "% (" << seconds_left / 60 << "m" << seconds_left % 60 << "s left)";
-            std::cerr << stream.str() << std::flush;
-
-            if (progress % (iterations / 100) == 0) {
-                #pragma omp critical
-                backup_output = get_output();
+            double x = 0;
+            for (uint64_t j = 1; j <= n; ++j) {
+                x += dist(gen);
+                for (size_t e = 0; e < epsilons.size(); ++e) {
+                    if (!models[e].add_point(x, j)) {
+                        ++counts[e];
+                        models[e].add_point(x, j);
+                    }
+                }
+
+                if (j % step == 0)
+                    for (size_t e = 0; e < epsilons.size(); ++e)
+                        checkpoints[e * n_checkpoints + j / step] = counts[e];
             }
+        };
+
+        #pragma omp for
+        for (size_t i = 0; i < iterations; ++i) {
+            std::fill(counts.begin(), counts.end(), 1);
+            for (size_t e = 0; e < epsilons.size(); ++e)
+                checkpoints[e * n_checkpoints] = 1;
+
+            if (opt)
+                generate_stream(opt_models);
+            else
+                generate_stream(met_models);
+
+            {
+                std::lock_guard<std::mutex> lock(local.mutex);
+                for (size_t j = 0; j < checkpoints.size(); ++j)
+                    local.segments[j].push(checkpoints[j]);
+            }
+
+            reporter.advance(thread_index());
         }
     }
 
+    reporter.finish();
     std::cout << get_output().str();
 }
 
 int main(int argc, char **argv) {
-    args::ArgumentParser ap("Experiment the number of segments of the MET algorithm on random streams of"
+    args::ArgumentParser ap("Experiment the number of segments of the MET or OPT algorithm on random streams of "
                             "increasing length.", "");
     args::HelpFlag help(ap, "help", "Display this help menu", {'h', "help"});
 
@@ -120,7 +176,11 @@ int main(int argc, char **argv) {
     args::ValueFlag<size_t> n(o, "n", "Maximum length of each stream", {'n'}, args::Options::Required);
     args::ValueFlag<size_t> step(o, "step", "The output contains n/step samples", {'s'}, 1);
     args::ValueFlag<size_t> threads(o, "threads", "Number of threads", {'t'}, 4);
-    args::ValueFlag<size_t> epsilon(o, "epsilon", "Value of ε", {'e'}, 16);
+    args::ValueFlagList<size_t> epsilon(o, "epsilon", "Value of ε (repeat to evaluate many values on the same "
+                                                  "streams, default 16)", {'e'});
+    args::Flag opt(o, "opt", "Count the segments of the OPT algorithm rather than MET", {"opt"});
+    args::ValueFlag<std::string> metrics(o, "path", "Serve the progress metrics over HTTP on this Unix socket",
+                                         {"metrics"});
 
     try {
         ap.ParseCLI(argc, argv);
@@ -135,21 +195,25 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    auto epsilons = epsilon.Get();
+    if (epsilons.empty())
+        epsilons.push_back(16);
+
     auto params = parameters.Get();
     if (uniform) {
         std::uniform_real_distribution<double> d(params.at(0), params.at(1));
-        run_experiment(d, epsilon.Get(), n.Get(), step.Get(), iters.Get(), threads.Get());
+        run_experiment(d, epsilons, opt.Get(), n.Get(), step.Get(), iters.Get(), threads.Get(), metrics.Get());
     } else if (pareto) {
         pareto_distribution<double> d(params.at(0), params.at(1));
-        run_experiment(d, epsilon.Get(), n.Get(), step.Get(), iters.Get(), threads.Get());
+        run_experiment(d, epsilons, opt.Get(), n.Get(), step.Get(), iters.Get(), threads.Get(), metrics.Get());
     } else if (lognormal) {
         std::lognormal_distribution<double> d(params.at(0), params.at(1));
-        run_experiment(d, epsilon.Get(), n.Get(), step.Get(), iters.Get(), threads.Get());
+        run_experiment(d, epsilons, opt.Get(), n.Get(), step.Get(), iters.Get(), threads.Get(), metrics.Get());
     } else if (exponential) {
         std::exponential_distribution<double> d(params.at(0));
-        run_experiment(d, epsilon.Get(), n.Get(), step.Get(), iters.Get(), threads.Get());
+        run_experiment(d, epsilons, opt.Get(), n.Get(), step.Get(), iters.Get(), threads.Get(), metrics.Get());
     } else if (gamma) {
         std::gamma_distribution<double> d(params.at(0), params.at(1));
-        run_experiment(d, epsilon.Get(), n.Get(), step.Get(), iters.Get(), threads.Get());
+        run_experiment(d, epsilons, opt.Get(), n.Get(), step.Get(), iters.Get(), threads.Get(), metrics.Get());
     }
 }
\ No newline at end of file
@@ -16,12 +16,17 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <tuple>
+#include <mutex>
+#include <memory>
 #include <random>
 #include <chrono>
 #include <iostream>
 #include "args.hxx"
 #include "stats.hpp"
 #include "common.hpp"
+#include "numa.hpp"
+#include "datasets.hpp"
+#include "progress.hpp"
 
 struct ExperimentConfig {
     size_t min_epsilon;
@@ -32,6 +37,12 @@ struct ExperimentConfig {
     bool met_only;
     size_t ma_order;
     double ar1_phi;
+    size_t shard;
+    size_t n_shards;
+    bool seeded;
+    uint64_t seed;
+    bool numa;
+    std::string metrics_socket;
 
     ExperimentConfig(size_t min_epsilon,
                      size_t max_epsilon,
@@ -40,7 +51,13 @@ struct ExperimentConfig {
                      size_t threads,
                      bool met_only,
                      size_t ma_order,
-                     double ar1_phi)
+                     double ar1_phi,
+                     size_t shard,
+                     size_t n_shards,
+                     bool seeded,
+                     uint64_t seed,
+                     bool numa,
+                     std::string metrics_socket)
         : min_epsilon(min_epsilon),
           max_epsilon(max_epsilon),
           step(step),
@@ -48,81 +65,108 @@ struct ExperimentConfig {
           threads(threads),
           met_only(met_only),
           ma_order(ma_order ? ma_order : 1),
-          ar1_phi(ar1_phi) {}
+          ar1_phi(ar1_phi),
+          shard(shard),
+          n_shards(n_shards),
+          seeded(seeded),
+          seed(seed),
+          numa(numa),
+          metrics_socket(std::move(metrics_socket)) {}
+
+    /** Returns the range of iterations assigned to this shard. */
+    std::pair<size_t, size_t> shard_range() const {
+        auto first = iterations / n_shards * shard + std::min(shard, iterations % n_shards);
+        auto last = first + iterations / n_shards + (shard < iterations % n_shards);
+        return {first, last};
+    }
 };
 
 template<typename F>
 void run_experiment(const ExperimentConfig &exp, const F &f) {
-    auto begin = std::chrono::steady_clock::now();
-    size_t progress = 0;
-    auto n_epsilon_values = exp.max_epsilon - exp.min_epsilon + 1;
-
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<uint64_t> epsilon_distribution(0, exp.max_epsilon - exp.min_epsilon);
-    std::vector<RunningStat> opt_exit_times(n_epsilon_values);
-    std::vector<RunningStat> opt_lo(n_epsilon_values);
-    std::vector<RunningStat> opt_hi(n_epsilon_values);
-    std::vector<RunningStat> mean_exit_times(n_epsilon_values);
+    auto[first_iteration, last_iteration] = exp.shard_range();
+    auto iterations = last_iteration - first_iteration;
+
+    // Each thread accumulates into its own statistics, allocated by the thread itself and thus on its NUMA node
+    struct alignas(64) ThreadStats {
+        std::mutex mutex;
+        std::unique_ptr<ExitTimeStats> stats;
+    };
+    std::vector<ThreadStats> thread_stats(exp.threads);
+
+    auto get_stats = [&] {
+        ExitTimeStats stats(exp.min_epsilon, exp.max_epsilon, exp.step);
+        for (auto &t : thread_stats) {
+            std::lock_guard<std::mutex> lock(t.mutex);
+            if (t.stats)
+                stats.merge(*t.stats);
+        }
+        return stats;
+    };
 
     auto get_output = [&] {
+        auto stats = get_stats();
         std::stringstream s;
-        s.precision(17);
-        s << "epsilon,"
-             "opt_avg,opt_std,"
-             "opt_lo_avg,opt_lo_std,"
-             "opt_hi_avg,opt_hi_std,"
-             "met_avg,met_std,"
-             "samples" << std::endl;
-        for (size_t i = 0; i < opt_exit_times.size(); i += exp.step)
-            s << i + exp.min_epsilon
-              << "," << opt_exit_times[i].mean() << "," << opt_exit_times[i].standard_deviation()
-              << "," << opt_lo[i].mean() << "," << opt_lo[i].standard_deviation()
-              << "," << opt_hi[i].mean() << "," << opt_hi[i].standard_deviation()
-              << "," << mean_exit_times[i].mean() << "," << mean_exit_times[i].standard_deviation()
-              << "," << mean_exit_times[i].samples() << std::endl;
+        if (exp.n_shards > 1)
+            stats.write_partial(s);
+        else
+            stats.write_csv(s);
         return s;
     };
 
     std::signal(SIGINT, signal_handler);
     std::signal(SIGUSR1, signal_handler);
 
-    #pragma omp parallel for num_threads(exp.threads)
-    for (size_t i = 0; i < exp.iterations; ++i) {
-        auto eps = epsilon_distribution(gen);
-        auto nearest_multiple = ((eps + exp.step / 2) / exp.step) * exp.step;
-        eps = exp.min_epsilon + std::min(exp.max_epsilon - exp.min_epsilon, nearest_multiple);
-
-        auto[opt_exit_t, exit_t, lo, hi] = f(eps);
-
-        #pragma omp critical
-        if (opt_exit_t != infinite_exit_time) {
-            size_t j = eps - exp.min_epsilon;
-            opt_exit_times[j].push(opt_exit_t);
-            mean_exit_times[j].push(exit_t);
-            opt_lo[j].push(lo);
-            opt_hi[j].push(hi);
+    if (exp.n_shards > 1)
+        std::cout << "# shard " << exp.shard << "/" << exp.n_shards << std::endl;
+
+    auto get_metrics = [&](std::ostream &s) {
+        auto stats = get_stats();
+        for (size_t j = 0; j < stats.mean_exit_times.size(); j += exp.step)
+            s << "samples{epsilon=\"" << j + exp.min_epsilon << "\"} " << stats.mean_exit_times[j].samples() << "\n";
+    };
+    ProgressReporter reporter(iterations, exp.threads, get_output, get_metrics, exp.metrics_socket);
+
+    #pragma omp parallel num_threads(exp.threads)
+    {
+        if (exp.numa) {
+            auto nodes = numa_nodes();
+            pin_current_thread(nodes[numa_node_of_thread(thread_index(), team_size(), nodes.size())]);
         }
 
-        #pragma atomic
-        ++progress;
-        if (exp.iterations > 1000 && progress % (exp.iterations / 1000) == 0) {
-            auto current = std::chrono::steady_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(current - begin).count();
-            auto seconds_left = exp.iterations * elapsed / progress - elapsed;
-            std::stringstream stream;
-            stream.precision(3);
-            stream << "\33[2K\r" << 100. * progress / exp.iterations
-                   << "% (" << seconds_left / 60 << "m" << seconds_left % 60 << "s left)";
-            std::cerr << stream.str() << std::flush;
-
-            if (progress % (exp.iterations / 100) == 0) {
-                #pragma omp critical
-                backup_output = get_output();
+        auto &local = thread_stats[thread_index()];
+        {
+            std::lock_guard<std::mutex> lock(local.mutex);
+            local.stats = std::make_unique<ExitTimeStats>(exp.min_epsilon, exp.max_epsilon, exp.step);
+        }
+
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        std::uniform_int_distribution<uint64_t> epsilon_distribution(0, exp.max_epsilon - exp.min_epsilon);
+
+        #pragma omp for
+        for (size_t i = first_iteration; i < last_iteration; ++i) {
+            if (exp.seeded) {
+                // Each iteration has its own stream, so the results do not depend on the sharding or the threads
+                std::seed_seq seq{uint32_t(exp.seed), uint32_t(exp.seed >> 32), uint32_t(i), uint32_t(i >> 32)};
+                gen.seed(seq);
             }
+
+            auto eps = epsilon_distribution(gen);
+            auto nearest_multiple = ((eps + exp.step / 2) / exp.step) * exp.step;
+            eps = exp.min_epsilon + std::min(exp.max_epsilon - exp.min_epsilon, nearest_multiple);
+
+            auto[opt_exit_t, exit_t, lo, hi] = f(gen, eps);
+
+            if (opt_exit_t != infinite_exit_time) {
+                std::lock_guard<std::mutex> lock(local.mutex);
+                local.stats->push(eps, opt_exit_t, exit_t, lo, hi);
+            }
+
+            reporter.advance(thread_index());
         }
     }
 
+    reporter.finish();
     std::cout << get_output().str();
 }
 
@@ -142,7 +186,7 @@ void run_experiment(ExperimentConfig &exp, Dist &distribution) {
                   << "# autoregressive process phi " << exp.ar1_phi << std::endl
                   << "# met constant " << met_constant << std::endl;
 
-        run_experiment(exp, [&](auto e) { return simulate_ar1(distribution, e, slope, exp.ar1_phi, exp.met_only); });
+        run_experiment(exp, [&](auto &gen, auto e) { return simulate_ar1(gen, distribution, e, slope, exp.ar1_phi, exp.met_only); });
         return;
     }
 
@@ -155,7 +199,7 @@ void run_experiment(ExperimentConfig &exp, Dist &distribution) {
               << "# moving-average process order " << exp.ma_order << std::endl
               << "# met constant " << mean * mean / variance << std::endl;
 
-    run_experiment(exp, [&](auto e) { return simulate(distribution, e, slope, exp.ma_order, exp.met_only); });
+    run_experiment(exp, [&](auto &gen, auto e) { return simulate(gen, distribution, e, slope, exp.ma_order, exp.met_only); });
 }
 
 int main(int argc, char **argv) {
@@ -168,6 +212,7 @@ int main(int argc, char **argv) {
     args::Command lognormal(distributions, "lognormal", "Lognormal (µ, σ)");
     args::Command exponential(distributions, "exponential", "Exponential (rate λ)");
     args::Command gamma(distributions, "gamma", "Gamma (shape k, scale θ)");
+    args::Command empirical(distributions, "empirical", "Gaps of the dataset given with --dataset");
 
     args::Group p(ap, "", args::Group::Validators::DontCare, args::Options::Required | args::Options::Global);
     args::PositionalList<double> parameters(p, "parameters", "The distribution parameters");
@@ -179,6 +224,19 @@ int main(int argc, char **argv) {
     args::ValueFlag<size_t> iters(o, "iterations", "Number of generated streams", {'i'}, size_t(1e7));
     args::ValueFlag<size_t> threads(o, "threads", "Number of threads", {'t'}, 4);
     args::Flag met(o, "met", "Simulate only the MET algorithm", {"met"});
+    args::ValueFlag<std::string> shard(o, "k/N", "Run only the k-th of N disjoint parts of the iterations and output "
+                                                 "a partial state to be combined with the merge tool", {"shard"});
+    args::ValueFlag<uint64_t> seed(o, "seed", "Seed the random stream of each iteration deterministically", {"seed"});
+    args::Flag numa(o, "numa", "Pin the threads to NUMA nodes", {"numa"});
+    args::ValueFlag<std::string> metrics(o, "path", "Serve the progress metrics over HTTP on this Unix socket",
+                                         {"metrics"});
+
+    args::Group e(ap, "options of the empirical distribution", args::Group::Validators::DontCare, args::Options::Global);
+    args::ValueFlag<std::string> dataset(e, "file", "The dataset whose gaps are sampled", {'d', "dataset"});
+    args::Flag binary_file(e, "binary", "Interpret the dataset as a binary file rather than a text file with numbers "
+                                        "separated by newlines", {'b'});
+    args::ValueFlag<size_t> block(e, "length", "Sample blocks of this many consecutive gaps (block bootstrap), "
+                                               "rather than independent gaps", {"block"}, 0);
 
     args::Group c(ap, "options to simulate correlation", args::Group::Validators::AtMostOne, args::Options::Global);
     args::ValueFlag<size_t> ma(c, "order", "Simulate a moving-average process MA(o) with the given order o", {'o'}, 0);
@@ -197,8 +255,20 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    size_t shard_index = 0;
+    size_t n_shards = 1;
+    if (shard) {
+        char slash;
+        std::stringstream spec(shard.Get());
+        if (!(spec >> shard_index >> slash >> n_shards) || slash != '/' || n_shards == 0 || shard_index >= n_shards) {
+            std::cerr << "Invalid shard " << shard.Get() << ", expected k/N with 0 <= k < N" << std::endl;
+            return 1;
+        }
+    }
+
     ExperimentConfig exp(min_eps.Get(), max_eps.Get(), step.Get(), iters.Get(), threads.Get(), met.Get(),
-                         ma.Get(), ar1.Get());
+                         ma.Get(), ar1.Get(), shard_index, n_shards, seed, seed.Get(),
+                         numa, metrics.Get());
 
     auto params = parameters.Get();
     if (uniform) {
@@ -216,5 +286,28 @@ int main(int argc, char **argv) {
     } else if (gamma) {
         std::gamma_distribution<double> d(params.at(0), params.at(1));
         run_experiment(exp, d);
+    } else if (empirical) {
+        if (!dataset) {
+            std::cerr << "The empirical distribution requires --dataset" << std::endl;
+            return 1;
+        }
+
+        std::vector<uint64_t> keys;
+        if (binary_file.Get())
+            keys = read_data_binary<uint64_t, uint64_t>(dataset.Get());
+        else
+            keys = read_dataset_csv<uint64_t>(dataset.Get());
+        sort_and_replace_with_gaps(keys);
+        if (keys.empty()) {
+            std::cerr << dataset.Get() << ": the empirical distribution requires at least 2 distinct keys" << std::endl;
+            return 1;
+        }
+
+        empirical_distribution<double> d(std::vector<double>(keys.begin(), keys.end()), block.Get());
+        std::vector<uint64_t>().swap(keys);
+        std::cout << "# dataset " << dataset.Get() << std::endl;
+        if (block.Get() > 1)
+            std::cout << "# bootstrap block length " << block.Get() << std::endl;
+        run_experiment(exp, d);
     }
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+// This file is part of
+// <https://github.com/gvinciguerra/Learned-indexes-effectiveness>.
+// Copyright (c) 2020 Giorgio Vinciguerra.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <random>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include "args.hxx"
+#include "datasets.hpp"
+#include "updatable_segmentation.hpp"
+
+struct ReplayConfig {
+    double initial_fraction;
+    size_t lookups_per_insert;
+    size_t buffer_capacity;
+    size_t windows;
+    uint64_t seed;
+
+    ReplayConfig(double initial_fraction, size_t lookups_per_insert, size_t buffer_capacity, size_t windows,
+                 uint64_t seed)
+        : initial_fraction(initial_fraction),
+          lookups_per_insert(lookups_per_insert),
+          buffer_capacity(buffer_capacity),
+          windows(std::max<size_t>(windows, 1)),
+          seed(seed) {}
+};
+
+/**
+ * Builds the structure on the first keys of the given permutation, then inserts the others in order, interleaving
+ * each batch of insertions with lookups of random keys inserted so far. Returns a csv row with the throughput of the
+ * insertions, the latency of the lookups in the first and last windows of the stream, and the cost of re-segmentations.
+ */
+std::string replay(const std::string &name, const std::vector<uint64_t> &permutation, size_t epsilon,
+                   const ReplayConfig &cfg) {
+    constexpr size_t batch = 256;
+    auto n = permutation.size();
+    auto n_initial = size_t(cfg.initial_fraction * n);
+    auto n_inserts = n - n_initial;
+    auto buffer_capacity = cfg.buffer_capacity ? cfg.buffer_capacity : 2 * epsilon;
+
+    std::vector<uint64_t> initial(permutation.begin(), permutation.begin() + n_initial);
+    std::sort(initial.begin(), initial.end());
+
+    auto begin = std::chrono::steady_clock::now();
+    UpdatableSegmentation<uint64_t> index(initial, epsilon, buffer_capacity);
+    auto end = std::chrono::steady_clock::now();
+    auto build_seconds = std::chrono::duration<double>(end - begin).count();
+    auto initial_segments = index.segments_count();
+    std::vector<uint64_t>().swap(initial);
+
+    std::mt19937_64 gen(cfg.seed);
+    auto window_size = (n_inserts + cfg.windows - 1) / cfg.windows;
+    std::vector<double> window_lookup_seconds(cfg.windows);
+    std::vector<size_t> window_lookups(cfg.windows);
+    double insert_seconds = 0;
+    size_t missed = 0;
+
+    for (size_t i = n_initial; i < n; i += batch) {
+        auto batch_end = std::min(n, i + batch);
+        auto w = (i - n_initial) / window_size;
+
+        begin = std::chrono::steady_clock::now();
+        for (auto j = i; j < batch_end; ++j)
+            index.insert(permutation[j]);
+        end = std::chrono::steady_clock::now();
+        insert_seconds += std::chrono::duration<double>(end - begin).count();
+
+        auto lookups = (batch_end - i) * cfg.lookups_per_insert;
+        std::uniform_int_distribution<size_t> present(0, batch_end - 1);
+        begin = std::chrono::steady_clock::now();
+        for (size_t j = 0; j < lookups; ++j)
+            missed += !index.contains(permutation[present(gen)]);
+        end = std::chrono::steady_clock::now();
+        window_lookup_seconds[w] += std::chrono::duration<double>(end - begin).count();
+        window_lookups[w] += lookups;
+    }
+
+    auto lookup_ns = [&](size_t w) {
+        return window_lookups[w] ? 1e9 * window_lookup_seconds[w] / window_lookups[w] : 0.;
+    };
+
+    std::stringstream row;
+    row << name << "," << n_initial << "," << n_inserts << "," << epsilon << "," << buffer_capacity << ","
+        << build_seconds << "," << (insert_seconds > 0 ? n_inserts / insert_seconds : 0.) << ","
+        << lookup_ns(0) << "," << lookup_ns(cfg.windows - 1) << ","
+        << index.resegmentations() << "," << index.resegmented_keys() << "," << index.resegmentation_seconds() << ","
+        << initial_segments << "," << index.segments_count() << "," << missed << std::endl;
+    return row.str();
+}
+
+int main(int argc, char **argv) {
+    args::ArgumentParser p("Replay a mixed stream of insertions and lookups over real data on an updatable "
+                           "segmentation of OptimalPiecewiseLinearModel, where each segment has a single insert "
+                           "buffer rather than a log-structured merge of many levels");
+    args::HelpFlag help(p, "help", "Display this help menu", {'h', "help"});
+    args::PositionalList<std::string> paths(p, "files", "Input files");
+    args::ValueFlagList<size_t> epsilon(p, "epsilon", "Value of ε (repeat to evaluate many values, default 64)", {'e'});
+    args::ValueFlag<double> initial(p, "fraction", "Fraction of the keys to build the structure on, the others are "
+                                                   "inserted in random order", {"initial"}, 0.5);
+    args::ValueFlag<size_t> lookups(p, "lookups", "Number of lookups per insertion", {'l', "lookups"}, 1);
+    args::ValueFlag<size_t> buffer(p, "capacity", "Insertions in a segment that trigger its re-segmentation "
+                                                  "(default 2ε)", {"buffer"}, 0);
+    args::ValueFlag<size_t> windows(p, "windows", "Number of windows of the stream, the lookup latency is reported "
+                                                  "for the first and the last one", {"windows"}, 10);
+    args::ValueFlag<uint64_t> seed(p, "seed", "Seed of the insertion order and of the lookups", {"seed"}, 42);
+    args::Flag binary_files(p, "binary", "Interpret the input files as binary files rather than "
+                                         "text files with numbers separated by newlines", {'b'});
+
+    try {
+        p.ParseCLI(argc, argv);
+    }
+    catch (args::Help) {
+        std::cout << p;
+        return 0;
+    }
+    catch (args::Error &e) {
+        std::cerr << e.what() << std::endl << p;
+        return 1;
+    }
+
+    auto epsilons = epsilon.Get();
+    if (epsilons.empty())
+        epsilons.push_back(64);
+    ReplayConfig cfg(std::clamp(initial.Get(), 0., 1.), lookups.Get(), buffer.Get(), windows.Get(), seed.Get());
+
+    std::cout.precision(6);
+    std::cout << "dataset,initial_keys,inserts,epsilon,buffer,build_seconds,inserts_per_second,"
+                 "lookup_ns_first,lookup_ns_last,resegmentations,resegmented_keys,resegmentation_seconds,"
+                 "segments_initial,segments_final,missed_lookups" << std::endl;
+
+    for (auto &&path : paths) {
+        auto name = path.substr(path.find_last_of("/\\") + 1);
+        std::vector<uint64_t> dataset;
+        if (binary_files.Get())
+            dataset = read_data_binary<uint64_t, uint64_t>(path);
+        else
+            dataset = read_dataset_csv<uint64_t>(path);
+        std::sort(dataset.begin(), dataset.end());
+        dataset.erase(std::unique(dataset.begin(), dataset.end()), dataset.end());
+        std::shuffle(dataset.begin(), dataset.end(), std::mt19937_64(cfg.seed));
+
+        // The values of ε are replayed one after another, as concurrent runs would skew the lookup latencies
+        for (auto e : epsilons)
+            std::cout << replay(name, dataset, e, cfg) << std::flush;
+    }
+
+    return 0;
+}